@@ -0,0 +1,196 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "benchmark.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <numeric>
+#include <random>
+
+namespace {
+
+std::atomic<uint64_t> allocation_count{0};
+
+}
+
+// Count allocations, e.g. to make sure hot paths don't allocate.
+void* operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (auto *ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace sw::assistant::benchmark {
+
+namespace {
+
+void write_string(std::ostream &os, const std::string &str) {
+    os << '"';
+    for (auto ch : str) {
+        switch (ch) {
+        case '"':
+            os << "\\\"";
+            break;
+
+        case '\\':
+            os << "\\\\";
+            break;
+
+        case '\n':
+            os << "\\n";
+            break;
+
+        case '\t':
+            os << "\\t";
+            break;
+
+        default:
+            if (static_cast<unsigned char>(ch) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", ch);
+                os << buf;
+            } else {
+                os << ch;
+            }
+            break;
+        }
+    }
+    os << '"';
+}
+
+void write_number(std::ostream &os, double val) {
+    if (!std::isfinite(val)) {
+        os << "null";
+        return;
+    }
+
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.6g", val);
+    os << buf;
+}
+
+}
+
+bool Reporter::enabled(const std::string &name) const {
+    // Either `name` matches the filter, or it's a group, e.g. vad., of the filtered benchmark.
+    auto len = std::min(name.size(), _filter.size());
+    return name.compare(0, len, _filter, 0, len) == 0;
+}
+
+void Reporter::add(Result result) {
+    _results.push_back(std::move(result));
+}
+
+void Reporter::write(std::ostream &os) const {
+    os << "{\n  \"benchmarks\": [";
+    for (std::size_t idx = 0; idx < _results.size(); ++idx) {
+        const auto &result = _results[idx];
+        os << (idx == 0 ? "\n" : ",\n") << "    {\"name\": ";
+        write_string(os, result.name);
+
+        os << ", \"params\": {";
+        for (std::size_t i = 0; i < result.params.size(); ++i) {
+            os << (i == 0 ? "" : ", ");
+            write_string(os, result.params[i].first);
+            os << ": ";
+            write_string(os, result.params[i].second);
+        }
+
+        os << "}, \"metrics\": {";
+        for (std::size_t i = 0; i < result.metrics.size(); ++i) {
+            os << (i == 0 ? "" : ", ");
+            write_string(os, result.metrics[i].first);
+            os << ": ";
+            write_number(os, result.metrics[i].second);
+        }
+        os << "}}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+Stats summarize(std::vector<double> samples) {
+    Stats stats;
+    if (samples.empty()) {
+        return stats;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) {
+        return samples[std::min(samples.size() - 1, static_cast<std::size_t>(p * samples.size()))];
+    };
+
+    stats.count = samples.size();
+    stats.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+    stats.min = samples.front();
+    stats.p50 = percentile(0.5);
+    stats.p90 = percentile(0.9);
+    stats.p99 = percentile(0.99);
+    stats.max = samples.back();
+
+    return stats;
+}
+
+void add_stats(Result &result, const std::string &prefix, const Stats &stats) {
+    result.metrics.emplace_back(prefix + "_mean", stats.mean);
+    result.metrics.emplace_back(prefix + "_min", stats.min);
+    result.metrics.emplace_back(prefix + "_p50", stats.p50);
+    result.metrics.emplace_back(prefix + "_p90", stats.p90);
+    result.metrics.emplace_back(prefix + "_p99", stats.p99);
+    result.metrics.emplace_back(prefix + "_max", stats.max);
+}
+
+uint64_t allocations() {
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+std::vector<float> make_audio(int sample_rate, int seconds) {
+    std::vector<float> audio(static_cast<std::size_t>(sample_rate) * seconds);
+    std::mt19937 gen(42);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+    for (std::size_t idx = 0; idx < audio.size(); ++idx) {
+        // 1 second of tone every 3 seconds.
+        auto t = static_cast<float>(idx) / sample_rate;
+        auto tone = (static_cast<int>(t) % 3 == 0) ? 0.3f * std::sin(2.0f * 3.1415926f * 220.0f * t) : 0.0f;
+        audio[idx] = tone + noise(gen);
+    }
+
+    return audio;
+}
+
+double measure(const std::function<void ()> &func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double>(end - start).count();
+}
+
+}
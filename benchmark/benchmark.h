@@ -0,0 +1,119 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_BENCHMARK_BENCHMARK_H
+#define SEWENEW_ASSISTANT_BENCHMARK_BENCHMARK_H
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace sw::assistant::benchmark {
+
+struct Config {
+    // Seconds of generated audio.
+    int seconds = 60;
+
+    // Path to silero_vad.onnx. VAD benchmark is skipped if it's empty.
+    std::string vad_model;
+
+    // Path to a quantized Silero model, which is compared with `vad_model` if it's not empty.
+    std::string vad_int8_model;
+
+    // Paths to ggml models. Whisper benchmark is skipped if it's empty.
+    std::vector<std::string> whisper_models;
+
+    // Seconds of audio per WhisperCpp::recognize call.
+    int whisper_seconds = 10;
+
+    // Directory of short WAV commands, with reference transcripts in .txt files of the same name.
+    // Generated audio is used if it's empty.
+    std::string whisper_corpus;
+
+    // Only run benchmarks whose name starts with it.
+    std::string filter;
+};
+
+struct Result {
+    // e.g. vad.bound_tensors
+    std::string name;
+
+    std::vector<std::pair<std::string, std::string>> params;
+
+    std::vector<std::pair<std::string, double>> metrics;
+};
+
+class Reporter {
+public:
+    explicit Reporter(std::string filter) : _filter(std::move(filter)) {}
+
+    // Whether benchmark, or group of benchmarks, `name` should run.
+    bool enabled(const std::string &name) const;
+
+    void add(Result result);
+
+    // {"benchmarks": [{"name": ..., "params": {...}, "metrics": {...}}, ...]}
+    void write(std::ostream &os) const;
+
+private:
+    std::string _filter;
+
+    std::vector<Result> _results;
+};
+
+// Summary of latencies, e.g. per-window inference time.
+struct Stats {
+    std::size_t count = 0;
+    double mean = 0;
+    double min = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+Stats summarize(std::vector<double> samples);
+
+// Append stats as metrics with `prefix`, e.g. latency_us_mean.
+void add_stats(Result &result, const std::string &prefix, const Stats &stats);
+
+// Number of allocations with global operator new so far.
+uint64_t allocations();
+
+// Mono float32 audio with a tone every few seconds on top of background noise.
+std::vector<float> make_audio(int sample_rate, int seconds);
+
+// Seconds elapsed by `func`.
+double measure(const std::function<void ()> &func);
+
+void pcm_benchmark(const Config &config, Reporter &reporter);
+
+void pipeline_benchmark(const Config &config, Reporter &reporter);
+
+void resampler_benchmark(const Config &config, Reporter &reporter);
+
+void vad_benchmark(const Config &config, Reporter &reporter);
+
+void wav_benchmark(const Config &config, Reporter &reporter);
+
+void whisper_benchmark(const Config &config, Reporter &reporter);
+
+}
+
+#endif // end SEWENEW_ASSISTANT_BENCHMARK_BENCHMARK_H
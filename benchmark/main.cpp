@@ -0,0 +1,109 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+// Benchmark of the audio, VAD and ASR hot paths. Results are written as JSON,
+// so that they can be diffed between releases. Audio is generated, so that
+// it runs headless.
+//
+// Usage: assistant_benchmark [--seconds N] [--vad silero_vad.onnx] [--vad-int8 silero_vad_int8.onnx]
+//                            [--whisper ggml-model.bin]... [--whisper-seconds N]
+//                            [--whisper-corpus dir] [--filter prefix] [--output result.json]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "benchmark.h"
+
+namespace {
+
+using namespace sw::assistant::benchmark;
+
+void usage(const char *name) {
+    std::fprintf(stderr, "Usage: %s [--seconds N] [--vad silero_vad.onnx] [--vad-int8 silero_vad_int8.onnx] "
+            "[--whisper ggml-model.bin]... [--whisper-seconds N] [--whisper-corpus dir] [--filter prefix] "
+            "[--output result.json]\n", name);
+}
+
+}
+
+int main(int argc, char **argv) {
+    Config config;
+    std::string output;
+    for (int idx = 1; idx < argc; ++idx) {
+        std::string arg = argv[idx];
+        if (idx + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        std::string val = argv[++idx];
+        if (arg == "--seconds") {
+            config.seconds = std::atoi(val.data());
+        } else if (arg == "--vad") {
+            config.vad_model = val;
+        } else if (arg == "--vad-int8") {
+            config.vad_int8_model = val;
+        } else if (arg == "--whisper") {
+            config.whisper_models.push_back(val);
+        } else if (arg == "--whisper-seconds") {
+            config.whisper_seconds = std::atoi(val.data());
+        } else if (arg == "--whisper-corpus") {
+            config.whisper_corpus = val;
+        } else if (arg == "--filter") {
+            config.filter = val;
+        } else if (arg == "--output") {
+            output = val;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (config.seconds <= 0 || config.whisper_seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Reporter reporter(config.filter);
+    try {
+        pcm_benchmark(config, reporter);
+        resampler_benchmark(config, reporter);
+        wav_benchmark(config, reporter);
+        vad_benchmark(config, reporter);
+        whisper_benchmark(config, reporter);
+        pipeline_benchmark(config, reporter);
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "benchmark failed: %s\n", e.what());
+        return 1;
+    }
+
+    if (output.empty()) {
+        reporter.write(std::cout);
+    } else {
+        std::ofstream file(output);
+        reporter.write(file);
+        if (!file) {
+            std::fprintf(stderr, "failed to write %s\n", output.data());
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+// Throughput of PCM conversion kernels.
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "benchmark.h"
+#include "sw/assistant/pcm.h"
+
+namespace sw::assistant::benchmark {
+
+namespace {
+
+constexpr int SAMPLE_RATE = 48000;
+
+constexpr int REPEAT = 5;
+
+void report(Reporter &reporter, const std::string &name, std::size_t samples,
+        const std::function<void ()> &func) {
+    auto full = "pcm." + name;
+    if (!reporter.enabled(full)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s\n", full.data());
+
+    // Best of several runs, so that page faults of the first run are excluded.
+    auto elapsed = measure(func);
+    for (int idx = 1; idx < REPEAT; ++idx) {
+        elapsed = std::min(elapsed, measure(func));
+    }
+
+    Result result;
+    result.name = std::move(full);
+    result.params.emplace_back("samples", std::to_string(samples));
+    result.metrics.emplace_back("msamples_per_sec", samples / elapsed / 1e6);
+    result.metrics.emplace_back("seconds", elapsed);
+    reporter.add(std::move(result));
+}
+
+}
+
+void pcm_benchmark(const Config &config, Reporter &reporter) {
+    auto audio = make_audio(SAMPLE_RATE, config.seconds);
+    auto samples = audio.size();
+
+    std::vector<int16_t> s16(samples);
+    std::vector<float> f32(samples);
+    pcm::f32_to_s16(audio.data(), samples, s16.data());
+
+    report(reporter, "s16_to_f32", samples, [&]() {
+        pcm::s16_to_f32(s16.data(), samples, f32.data());
+    });
+
+    report(reporter, "f32_to_s16", samples, [&]() {
+        pcm::f32_to_s16(audio.data(), samples, s16.data());
+    });
+
+    // Interleaved stereo S16 as captured by the recorder, i.e. samples / 2 frames.
+    report(reporter, "s16_stereo_to_mono_f32", samples, [&]() {
+        pcm::to_mono_f32(s16.data(), samples * sizeof(int16_t), AUDIO_S16SYS, 2, f32.data());
+    });
+
+    std::vector<uint8_t> stereo(samples * 2 * sizeof(int16_t));
+    report(reporter, "mono_f32_to_s16_stereo", samples, [&]() {
+        pcm::from_mono_f32(audio.data(), samples, AUDIO_S16SYS, 2, stereo.data());
+    });
+}
+
+}
@@ -0,0 +1,80 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+// Throughput of the whole capture -> resample -> VAD -> ASR pipeline, replaying generated
+// 48 kHz stereo audio unthrottled, i.e. without sound hardware.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include "benchmark.h"
+#include "sw/assistant/pipeline.h"
+#include "sw/assistant/synthetic_source.h"
+#include "sw/assistant/vad.h"
+#include "sw/assistant/whisper_cpp.h"
+
+namespace sw::assistant::benchmark {
+
+void pipeline_benchmark(const Config &config, Reporter &reporter) {
+    const std::string name = "pipeline.replay";
+    if (config.vad_model.empty() || config.whisper_models.empty() || !reporter.enabled(name)) {
+        return;
+    }
+
+    const auto &model = config.whisper_models.front();
+    std::fprintf(stderr, "running %s with %s\n", name.data(), model.data());
+
+    SyntheticSourceOptions source_opts;
+    source_opts.audio = {2, 48000, AUDIO_S16SYS};
+    source_opts.duration = std::chrono::seconds(config.seconds);
+    source_opts.speed = 0.0;
+    SyntheticSource source(source_opts);
+
+    VadModel vad(config.vad_model);
+
+    whisper_params params;
+    params.model = model;
+    params.no_timestamps = true;
+    WhisperCpp whisper(params);
+
+    std::atomic<std::size_t> transcripts{0};
+    Pipeline pipeline(source, vad, whisper, [&transcripts](const Transcript &) {
+        transcripts.fetch_add(1, std::memory_order_relaxed);
+    });
+
+    auto elapsed = measure([&]() {
+        pipeline.start();
+        pipeline.wait();
+    });
+
+    auto stats = pipeline.stats();
+    auto seconds = static_cast<double>(config.seconds);
+
+    Result result;
+    result.name = name;
+    result.params.emplace_back("model", model);
+    result.params.emplace_back("seconds", std::to_string(config.seconds));
+    result.metrics.emplace_back("realtime_factor", elapsed / seconds);
+    result.metrics.emplace_back("audio_seconds_per_sec", seconds / elapsed);
+    result.metrics.emplace_back("transcripts", static_cast<double>(transcripts.load()));
+    result.metrics.emplace_back("capture_high_watermark", static_cast<double>(stats.capture.high_watermark));
+    result.metrics.emplace_back("audio_high_watermark", static_cast<double>(stats.audio.high_watermark));
+    result.metrics.emplace_back("speech_high_watermark", static_cast<double>(stats.speech.high_watermark));
+    reporter.add(std::move(result));
+}
+
+}
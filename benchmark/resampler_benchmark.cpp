@@ -0,0 +1,73 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+// Throughput of Resampler from common capture rates to 16 kHz, on a single core.
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "benchmark.h"
+#include "sw/assistant/resampler.h"
+
+namespace sw::assistant::benchmark {
+
+namespace {
+
+constexpr int OUT_RATE = 16000;
+
+constexpr std::size_t CHUNK = 1024;
+
+void run(const Config &config, Reporter &reporter, int in_rate) {
+    auto name = "resampler." + std::to_string(in_rate) + "_to_" + std::to_string(OUT_RATE);
+    if (!reporter.enabled(name)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s\n", name.data());
+
+    auto audio = make_audio(in_rate, config.seconds);
+
+    Resampler resampler(in_rate, OUT_RATE);
+    std::vector<float> out(resampler.max_output(CHUNK));
+
+    std::size_t produced = 0;
+    auto elapsed = measure([&]() {
+        for (std::size_t idx = 0; idx < audio.size(); idx += CHUNK) {
+            auto size = std::min(CHUNK, audio.size() - idx);
+            produced += resampler.process(Span<const float>(audio.data() + idx, size), out.data());
+        }
+    });
+
+    Result result;
+    result.name = std::move(name);
+    result.params.emplace_back("chunk", std::to_string(CHUNK));
+    result.params.emplace_back("seconds", std::to_string(config.seconds));
+    result.metrics.emplace_back("input_msamples_per_sec", audio.size() / elapsed / 1e6);
+    result.metrics.emplace_back("output_msamples_per_sec", produced / elapsed / 1e6);
+    result.metrics.emplace_back("realtime_factor", elapsed / config.seconds);
+    reporter.add(std::move(result));
+}
+
+}
+
+void resampler_benchmark(const Config &config, Reporter &reporter) {
+    for (auto rate : {8000, 22050, 44100, 48000}) {
+        run(config, reporter, rate);
+    }
+}
+
+}
@@ -0,0 +1,348 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+// Per-window VAD inference: per-call tensors (the original VadModel::predict loop)
+// vs. tensors bound once in VadState, throughput of VadModel::predict with and without pre-gate,
+// cost of per-stream VadModel handles with shared vs. private sessions, and startup time and
+// per-window CPU with optimized model cache, execution providers and quantized models.
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "onnxruntime_cxx_api.h"
+#include "benchmark.h"
+#include "sw/assistant/errors.h"
+#include "sw/assistant/metrics.h"
+#include "sw/assistant/vad.h"
+
+namespace sw::assistant::benchmark {
+
+namespace {
+
+constexpr int64_t SAMPLE_RATE = 16000;
+constexpr std::size_t WINDOW_SIZE = 1024;
+constexpr std::size_t HANDLES = 32;
+
+// Returns 0 if /proc is not available.
+uint64_t proc_status(const std::string &field) {
+    std::ifstream file("/proc/self/status");
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, field.size() + 1, field + ":") == 0) {
+            return std::strtoull(line.data() + field.size() + 1, nullptr, 10);
+        }
+    }
+
+    return 0;
+}
+
+void report(Reporter &reporter, const std::string &name,
+        std::vector<double> latencies_us, uint64_t allocations) {
+    auto windows = latencies_us.size();
+    if (windows == 0) {
+        return;
+    }
+
+    auto stats = summarize(std::move(latencies_us));
+
+    Result result;
+    result.name = name;
+    result.params.emplace_back("window_size", std::to_string(WINDOW_SIZE));
+    result.params.emplace_back("windows", std::to_string(windows));
+    add_stats(result, "latency_us", stats);
+    result.metrics.emplace_back("windows_per_sec", 1e6 / stats.mean);
+    result.metrics.emplace_back("allocations_per_window", static_cast<double>(allocations) / windows);
+    reporter.add(std::move(result));
+}
+
+// Mirrors the original loop: 4 new input tensors, new output tensors and state copies per window.
+void run_per_call_tensors(const Config &config, Reporter &reporter, const std::vector<float> &audio) {
+    const std::string name = "vad.per_call_tensors";
+    if (!reporter.enabled(name)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s\n", name.data());
+
+    Ort::Env env;
+    Ort::SessionOptions session_options;
+    session_options.SetIntraOpNumThreads(1);
+    session_options.SetInterOpNumThreads(1);
+    session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+    Ort::Session session(env, config.vad_model.data(), session_options);
+    auto memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeCPU);
+
+    std::vector<const char *> input_node_names = {"input", "sr", "h", "c"};
+    std::vector<const char *> output_node_names = {"output", "hn", "cn"};
+    const int64_t input_node_dims[2] = {1, WINDOW_SIZE};
+    const int64_t hc_node_dims[3] = {2, 1, 64};
+    const int64_t sr_node_dims[1] = {1};
+    std::vector<float> h(VadState::HC_SIZE);
+    std::vector<float> c(VadState::HC_SIZE);
+    std::vector<int64_t> sr = {SAMPLE_RATE};
+
+    std::vector<double> latencies_us;
+    latencies_us.reserve(audio.size() / WINDOW_SIZE);
+    auto allocations_before = allocations();
+    for (std::size_t idx = 0; idx + WINDOW_SIZE <= audio.size(); idx += WINDOW_SIZE) {
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<Ort::Value> ort_inputs;
+        ort_inputs.push_back(Ort::Value::CreateTensor<float>(memory_info,
+                    const_cast<float *>(audio.data()) + idx, WINDOW_SIZE, input_node_dims, 2));
+        ort_inputs.push_back(Ort::Value::CreateTensor<int64_t>(memory_info, sr.data(), sr.size(), sr_node_dims, 1));
+        ort_inputs.push_back(Ort::Value::CreateTensor<float>(memory_info, h.data(), h.size(), hc_node_dims, 3));
+        ort_inputs.push_back(Ort::Value::CreateTensor<float>(memory_info, c.data(), c.size(), hc_node_dims, 3));
+        auto ort_outputs = session.Run(Ort::RunOptions{nullptr},
+                input_node_names.data(), ort_inputs.data(), ort_inputs.size(),
+                output_node_names.data(), output_node_names.size());
+        std::memcpy(h.data(), ort_outputs[1].GetTensorMutableData<float>(), h.size() * sizeof(float));
+        std::memcpy(c.data(), ort_outputs[2].GetTensorMutableData<float>(), c.size() * sizeof(float));
+
+        auto end = std::chrono::steady_clock::now();
+        latencies_us.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    }
+    auto allocations_after = allocations();
+
+    report(reporter, name, std::move(latencies_us), allocations_after - allocations_before);
+}
+
+void run_bound_tensors(VadModel &model, Reporter &reporter, const std::vector<float> &audio) {
+    const std::string name = "vad.bound_tensors";
+    if (!reporter.enabled(name)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s\n", name.data());
+
+    VadState state(WINDOW_SIZE, SAMPLE_RATE);
+    auto window = state.window();
+
+    std::vector<double> latencies_us;
+    latencies_us.reserve(audio.size() / WINDOW_SIZE);
+    auto allocations_before = allocations();
+    for (std::size_t idx = 0; idx + WINDOW_SIZE <= audio.size(); idx += WINDOW_SIZE) {
+        auto start = std::chrono::steady_clock::now();
+
+        std::copy_n(audio.data() + idx, WINDOW_SIZE, window.data());
+        model.infer(state);
+
+        auto end = std::chrono::steady_clock::now();
+        latencies_us.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    }
+    auto allocations_after = allocations();
+
+    report(reporter, name, std::move(latencies_us), allocations_after - allocations_before);
+}
+
+void run_predict(VadModel &model, Reporter &reporter, std::vector<float> &audio, bool gate) {
+    const std::string name = gate ? "vad.predict_gated" : "vad.predict";
+    if (!reporter.enabled(name)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s\n", name.data());
+
+    VadOptions opts;
+    opts.sample_rate = SAMPLE_RATE;
+    opts.window_size = std::chrono::milliseconds(WINDOW_SIZE * 1000 / SAMPLE_RATE);
+    opts.gate.enabled = gate;
+
+    auto &skipped = MetricsRegistry::instance().counter("assistant_vad_gate_skipped_total",
+            "Number of VAD windows skipped by pre-gate");
+    auto skipped_before = skipped.value();
+
+    std::size_t chunks = 0;
+    auto elapsed = measure([&]() {
+        chunks = model.predict(audio, opts).size();
+    });
+
+    auto seconds = static_cast<double>(audio.size()) / SAMPLE_RATE;
+
+    Result result;
+    result.name = name;
+    result.params.emplace_back("window_size", std::to_string(WINDOW_SIZE));
+    result.params.emplace_back("seconds", std::to_string(seconds));
+    result.metrics.emplace_back("realtime_factor", elapsed / seconds);
+    result.metrics.emplace_back("audio_seconds_per_sec", seconds / elapsed);
+    result.metrics.emplace_back("speech_chunks", chunks);
+    result.metrics.emplace_back("skipped_ratio",
+            static_cast<double>(skipped.value() - skipped_before) / (audio.size() / WINDOW_SIZE));
+    reporter.add(std::move(result));
+}
+
+// RSS and threads added by each VadModel handle, e.g. one per stream.
+void run_handles(const Config &config, Reporter &reporter, bool shared) {
+    const std::string name = shared ? "vad.shared_handles" : "vad.private_handles";
+    if (!reporter.enabled(name)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s\n", name.data());
+
+    VadModelOptions opts;
+    opts.shared = shared;
+
+    auto rss_before = proc_status("VmRSS");
+    auto threads_before = proc_status("Threads");
+
+    std::vector<std::unique_ptr<VadModel>> models;
+    auto elapsed = measure([&]() {
+        for (std::size_t idx = 0; idx < HANDLES; ++idx) {
+            models.push_back(std::make_unique<VadModel>(config.vad_model, opts));
+        }
+    });
+
+    auto rss_after = proc_status("VmRSS");
+    auto threads_after = proc_status("Threads");
+
+    Result result;
+    result.name = name;
+    result.params.emplace_back("handles", std::to_string(HANDLES));
+    result.metrics.emplace_back("create_ms_per_handle", elapsed * 1000 / HANDLES);
+    result.metrics.emplace_back("rss_kb_per_handle",
+            static_cast<double>(rss_after > rss_before ? rss_after - rss_before : 0) / HANDLES);
+    result.metrics.emplace_back("threads_per_handle",
+            static_cast<double>(threads_after > threads_before ? threads_after - threads_before : 0) / HANDLES);
+    reporter.add(std::move(result));
+}
+
+// Time to the first VAD decision of a new process, i.e. loading a private session and running
+// the first window, and then per-window latency and process CPU time.
+void run_startup(Reporter &reporter, const std::vector<float> &audio, const std::string &variant,
+        const std::string &model_path, const OnnxSessionOptions &session_opts) {
+    const std::string name = "vad.startup." + variant;
+    if (!reporter.enabled(name)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s\n", name.data());
+
+    VadModelOptions opts;
+    opts.shared = false;
+    opts.session = session_opts;
+
+    std::unique_ptr<VadModel> model;
+    VadState state(WINDOW_SIZE, SAMPLE_RATE);
+    auto window = state.window();
+    double create_seconds = 0.0;
+    try {
+        auto first_decision_seconds = measure([&]() {
+            create_seconds = measure([&]() {
+                model = std::make_unique<VadModel>(model_path, opts);
+            });
+
+            std::copy_n(audio.data(), WINDOW_SIZE, window.data());
+            model->infer(state);
+        });
+
+        Result result;
+        result.name = name;
+        result.params.emplace_back("model", model_path);
+        result.params.emplace_back("window_size", std::to_string(WINDOW_SIZE));
+        result.metrics.emplace_back("create_ms", create_seconds * 1000);
+        result.metrics.emplace_back("first_decision_ms", first_decision_seconds * 1000);
+
+        std::vector<double> latencies_us;
+        latencies_us.reserve(audio.size() / WINDOW_SIZE);
+        auto cpu_start = std::clock();
+        for (std::size_t idx = 0; idx + WINDOW_SIZE <= audio.size(); idx += WINDOW_SIZE) {
+            auto start = std::chrono::steady_clock::now();
+
+            std::copy_n(audio.data() + idx, WINDOW_SIZE, window.data());
+            model->infer(state);
+
+            auto end = std::chrono::steady_clock::now();
+            latencies_us.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+        }
+        auto cpu_end = std::clock();
+
+        auto windows = latencies_us.size();
+        add_stats(result, "latency_us", summarize(std::move(latencies_us)));
+        result.metrics.emplace_back("cpu_us_per_window",
+                static_cast<double>(cpu_end - cpu_start) * 1e6 / CLOCKS_PER_SEC / std::max<std::size_t>(windows, 1));
+        reporter.add(std::move(result));
+    } catch (const Error &e) {
+        // e.g. execution provider is not built into ONNX Runtime.
+        std::fprintf(stderr, "skip %s: %s\n", name.data(), e.what());
+    }
+}
+
+void run_startups(const Config &config, Reporter &reporter, const std::vector<float> &audio) {
+    run_startup(reporter, audio, "default", config.vad_model, {});
+
+    // The first load optimizes and saves the model, and the measured one loads it.
+    auto cache_path = (std::filesystem::temp_directory_path() / "assistant_benchmark_vad.opt.onnx").string();
+    std::filesystem::remove(cache_path);
+    OnnxSessionOptions cached;
+    cached.optimized_model_path = cache_path;
+    if (reporter.enabled("vad.startup.cached")) {
+        VadModelOptions opts;
+        opts.shared = false;
+        opts.session = cached;
+        VadModel warm_up(config.vad_model, opts);
+    }
+    run_startup(reporter, audio, "cached", config.vad_model, cached);
+    std::filesystem::remove(cache_path);
+
+    for (const std::string provider : {"XNNPACK", "DNNL"}) {
+        OnnxSessionOptions opts;
+        opts.execution_providers.push_back(provider);
+        auto variant = provider;
+        std::transform(variant.begin(), variant.end(), variant.begin(),
+                [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        run_startup(reporter, audio, variant, config.vad_model, opts);
+    }
+
+    if (!config.vad_int8_model.empty()) {
+        run_startup(reporter, audio, "int8", config.vad_int8_model, {});
+    }
+}
+
+}
+
+void vad_benchmark(const Config &config, Reporter &reporter) {
+    if (config.vad_model.empty() || !reporter.enabled("vad.")) {
+        return;
+    }
+
+    auto audio = make_audio(SAMPLE_RATE, config.seconds);
+    // Whole windows only.
+    audio.resize(audio.size() / WINDOW_SIZE * WINDOW_SIZE);
+
+    run_per_call_tensors(config, reporter, audio);
+
+    VadModel model(config.vad_model);
+    run_bound_tensors(model, reporter, audio);
+    run_predict(model, reporter, audio, false);
+    run_predict(model, reporter, audio, true);
+
+    run_handles(config, reporter, true);
+    run_handles(config, reporter, false);
+
+    run_startups(config, reporter, audio);
+}
+
+}
@@ -0,0 +1,161 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+// Throughput of WavWriter and WavReader.
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "benchmark.h"
+#include "sw/assistant/pcm.h"
+#include "sw/assistant/wav.h"
+
+namespace sw::assistant::benchmark {
+
+namespace {
+
+constexpr int SAMPLE_RATE = 44100;
+
+constexpr int REPEAT = 5;
+
+void run_write(Reporter &reporter, const std::string &path,
+        const WavOptions &options, const std::vector<uint8_t> &data) {
+    const std::string name = "wav.write";
+    if (!reporter.enabled(name)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s\n", name.data());
+
+    std::vector<double> elapsed;
+    for (int idx = 0; idx < REPEAT; ++idx) {
+        WavWriter writer;
+        elapsed.push_back(measure([&]() {
+            writer.write(path, options, data);
+        }));
+    }
+
+    auto best = *std::min_element(elapsed.begin(), elapsed.end());
+
+    Result result;
+    result.name = name;
+    result.params.emplace_back("bytes", std::to_string(data.size()));
+    result.params.emplace_back("channels", std::to_string(options.channels));
+    result.params.emplace_back("sample_rate", std::to_string(SAMPLE_RATE));
+    result.metrics.emplace_back("mbytes_per_sec", data.size() / best / 1e6);
+    result.metrics.emplace_back("seconds", best);
+    reporter.add(std::move(result));
+}
+
+// Append 10ms chunks as they would arrive from the recorder.
+void run_append(Reporter &reporter, const std::string &path,
+        const WavOptions &options, const std::vector<uint8_t> &data) {
+    const std::string name = "wav.append";
+    if (!reporter.enabled(name)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s\n", name.data());
+
+    std::size_t chunk = SAMPLE_RATE / 100 * options.channels * sizeof(int16_t);
+
+    std::vector<double> elapsed;
+    for (int idx = 0; idx < REPEAT; ++idx) {
+        WavWriter writer;
+        elapsed.push_back(measure([&]() {
+            writer.open(path, options);
+            for (std::size_t offset = 0; offset < data.size(); offset += chunk) {
+                writer.append(data.data() + offset, std::min(chunk, data.size() - offset));
+            }
+            writer.close();
+        }));
+    }
+
+    auto best = *std::min_element(elapsed.begin(), elapsed.end());
+
+    Result result;
+    result.name = name;
+    result.params.emplace_back("bytes", std::to_string(data.size()));
+    result.params.emplace_back("chunk", std::to_string(chunk));
+    result.metrics.emplace_back("mbytes_per_sec", data.size() / best / 1e6);
+    result.metrics.emplace_back("seconds", best);
+    reporter.add(std::move(result));
+}
+
+// Open the file, and touch every sample, i.e. the cost of page faults, since samples are not copied.
+void run_read(Reporter &reporter, const std::string &path) {
+    const std::string name = "wav.read";
+    if (!reporter.enabled(name)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s\n", name.data());
+
+    std::size_t bytes = 0;
+    int64_t sum = 0;
+    std::vector<double> elapsed;
+    for (int idx = 0; idx < REPEAT; ++idx) {
+        elapsed.push_back(measure([&]() {
+            WavReader reader(path);
+            bytes = reader.data().size();
+            for (auto sample : reader.samples<int16_t>()) {
+                sum += sample;
+            }
+        }));
+    }
+
+    auto best = *std::min_element(elapsed.begin(), elapsed.end());
+
+    Result result;
+    result.name = name;
+    result.params.emplace_back("bytes", std::to_string(bytes));
+    result.metrics.emplace_back("mbytes_per_sec", bytes / best / 1e6);
+    result.metrics.emplace_back("seconds", best);
+    // Keep the loop from being optimized away.
+    result.metrics.emplace_back("checksum", static_cast<double>(sum));
+    reporter.add(std::move(result));
+}
+
+}
+
+void wav_benchmark(const Config &config, Reporter &reporter) {
+    if (!reporter.enabled("wav.")) {
+        return;
+    }
+
+    WavOptions options;
+    options.channels = 2;
+    options.sample_per_second = SAMPLE_RATE;
+    options.format = AUDIO_S16SYS;
+
+    auto audio = make_audio(SAMPLE_RATE, config.seconds);
+    std::vector<uint8_t> data(audio.size() * options.channels * sizeof(int16_t));
+    pcm::from_mono_f32(audio.data(), audio.size(), options.format, options.channels, data.data());
+
+    auto path = (std::filesystem::temp_directory_path() / "assistant_benchmark.wav").string();
+
+    WavWriter().write(path, options, data);
+
+    run_write(reporter, path, options, data);
+    run_append(reporter, path, options, data);
+    run_read(reporter, path);
+
+    std::filesystem::remove(path);
+}
+
+}
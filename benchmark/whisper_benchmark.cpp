@@ -0,0 +1,381 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+// Real time factor of WhisperCpp::recognize, i.e. processing time / audio duration,
+// for several whisper_params configurations, time to the first transcript with and without
+// warm-up, and latency and word error rate of short commands decoded with adaptive audio
+// context, compared with full context.
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "benchmark.h"
+#include "sw/assistant/metrics.h"
+#include "sw/assistant/pcm.h"
+#include "sw/assistant/wav.h"
+#include "sw/assistant/whisper_cpp.h"
+
+namespace sw::assistant::benchmark {
+
+namespace {
+
+constexpr int REPEAT = 3;
+
+struct WhisperConfig {
+    std::string name;
+    int32_t n_threads;
+    int32_t beam_size;
+    bool adaptive_beam = false;
+};
+
+std::vector<WhisperConfig> whisper_configs() {
+    int32_t threads = std::clamp(static_cast<int32_t>(std::thread::hardware_concurrency()), 1, 8);
+
+    return {
+        {"greedy_t1", 1, 1},
+        {"greedy_t" + std::to_string(threads), threads, 1},
+        {"beam5_t" + std::to_string(threads), threads, 5},
+        {"adaptive_beam5_t" + std::to_string(threads), threads, 5, true},
+    };
+}
+
+void run(const Config &config, Reporter &reporter, const std::string &model,
+        const WhisperConfig &whisper_config, const std::vector<uint8_t> &wav) {
+    auto name = "whisper." + whisper_config.name;
+    if (!reporter.enabled(name)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s with %s\n", name.data(), model.data());
+
+    whisper_params params;
+    params.model = model;
+    params.n_threads = whisper_config.n_threads;
+    params.beam_size = whisper_config.beam_size;
+    params.adaptive_beam = whisper_config.adaptive_beam;
+    params.no_timestamps = true;
+
+    std::unique_ptr<WhisperCpp> whisper;
+    auto load_seconds = measure([&]() {
+        whisper = std::make_unique<WhisperCpp>(params);
+    });
+
+    WavOptions opts;
+    opts.channels = 1;
+    opts.sample_per_second = WHISPER_SAMPLE_RATE;
+    opts.format = AUDIO_S16SYS;
+
+    auto &redecoded = MetricsRegistry::instance().counter("assistant_whisper_beam_redecoded_total",
+            "Number of low confidence segments decoded again with beam search");
+    auto redecoded_start = redecoded.value();
+
+    std::vector<double> rtf;
+    for (int idx = 0; idx < REPEAT; ++idx) {
+        auto elapsed = measure([&]() {
+            whisper->recognize(wav, opts);
+        });
+        rtf.push_back(elapsed / config.whisper_seconds);
+    }
+
+    auto stats = summarize(std::move(rtf));
+
+    Result result;
+    result.name = std::move(name);
+    result.params.emplace_back("model", model);
+    result.params.emplace_back("n_threads", std::to_string(whisper_config.n_threads));
+    result.params.emplace_back("beam_size", std::to_string(whisper_config.beam_size));
+    result.params.emplace_back("adaptive_beam", whisper_config.adaptive_beam ? "true" : "false");
+    result.params.emplace_back("seconds", std::to_string(config.whisper_seconds));
+    result.metrics.emplace_back("load_seconds", load_seconds);
+    result.metrics.emplace_back("realtime_factor_mean", stats.mean);
+    result.metrics.emplace_back("realtime_factor_min", stats.min);
+    result.metrics.emplace_back("realtime_factor_max", stats.max);
+    result.metrics.emplace_back("beam_redecoded_per_request",
+            static_cast<double>(redecoded.value() - redecoded_start) / REPEAT);
+    reporter.add(std::move(result));
+}
+
+void run_startup(const Config &config, Reporter &reporter, const std::string &model,
+        int32_t warm_up_ms, const std::vector<uint8_t> &wav) {
+    auto name = std::string("whisper.startup.") + (warm_up_ms > 0 ? "warm_up" : "cold");
+    if (!reporter.enabled(name)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s with %s\n", name.data(), model.data());
+
+    whisper_params params;
+    params.model = model;
+    params.warm_up_ms = warm_up_ms;
+    params.no_timestamps = true;
+
+    WavOptions opts;
+    opts.channels = 1;
+    opts.sample_per_second = WHISPER_SAMPLE_RATE;
+    opts.format = AUDIO_S16SYS;
+
+    std::unique_ptr<WhisperCpp> whisper;
+    double first_request_seconds = 0.0;
+    auto first_transcript_seconds = measure([&]() {
+        whisper = std::make_unique<WhisperCpp>(params);
+        first_request_seconds = measure([&]() {
+            whisper->recognize(wav, opts);
+        });
+    });
+
+    auto second_request_seconds = measure([&]() {
+        whisper->recognize(wav, opts);
+    });
+
+    const auto &timings = whisper->startup_timings();
+    auto to_ms = [](std::chrono::microseconds us) { return us.count() / 1000.0; };
+
+    Result result;
+    result.name = std::move(name);
+    result.params.emplace_back("model", model);
+    result.params.emplace_back("seconds", std::to_string(config.whisper_seconds));
+    result.metrics.emplace_back("load_ms", to_ms(timings.load));
+    result.metrics.emplace_back("init_states_ms", to_ms(timings.init_states));
+    result.metrics.emplace_back("warm_up_ms", to_ms(timings.warm_up));
+    result.metrics.emplace_back("first_request_ms", first_request_seconds * 1000);
+    result.metrics.emplace_back("second_request_ms", second_request_seconds * 1000);
+    result.metrics.emplace_back("first_transcript_ms", first_transcript_seconds * 1000);
+    reporter.add(std::move(result));
+}
+
+struct Command {
+    std::string name;
+
+    // Mono float32 at WHISPER_SAMPLE_RATE.
+    std::vector<float> audio;
+
+    // Words of the reference transcript, if any.
+    std::vector<std::string> reference;
+};
+
+// Lower case words without punctuation.
+std::vector<std::string> words(const std::string &text) {
+    std::string normalized;
+    for (unsigned char c : text) {
+        if (std::isalnum(c) || c == '\'') {
+            normalized.push_back(static_cast<char>(std::tolower(c)));
+        } else {
+            normalized.push_back(' ');
+        }
+    }
+
+    std::istringstream is(normalized);
+    return {std::istream_iterator<std::string>(is), std::istream_iterator<std::string>()};
+}
+
+// Word level edit distance.
+std::size_t word_errors(const std::vector<std::string> &reference, const std::vector<std::string> &hypothesis) {
+    std::vector<std::size_t> prev(hypothesis.size() + 1);
+    std::vector<std::size_t> cur(hypothesis.size() + 1);
+    for (std::size_t j = 0; j <= hypothesis.size(); ++j) {
+        prev[j] = j;
+    }
+
+    for (std::size_t i = 1; i <= reference.size(); ++i) {
+        cur[0] = i;
+        for (std::size_t j = 1; j <= hypothesis.size(); ++j) {
+            auto substitution = prev[j - 1] + (reference[i - 1] == hypothesis[j - 1] ? 0 : 1);
+            cur[j] = std::min({prev[j] + 1, cur[j - 1] + 1, substitution});
+        }
+        std::swap(prev, cur);
+    }
+
+    return prev[hypothesis.size()];
+}
+
+// WAV files of `dir`, with reference transcripts in .txt files of the same name, if any.
+// Without a corpus, clips of generated audio from 1 to 3 seconds are used, and only
+// agreement with full context can be measured.
+std::vector<Command> load_commands(const std::string &dir) {
+    std::vector<Command> commands;
+    if (dir.empty()) {
+        for (auto seconds : {1, 2, 3}) {
+            commands.push_back(Command{"generated_" + std::to_string(seconds) + "s",
+                    make_audio(WHISPER_SAMPLE_RATE, seconds), {}});
+        }
+
+        return commands;
+    }
+
+    std::vector<std::filesystem::path> paths;
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".wav") {
+            paths.push_back(entry.path());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    for (const auto &path : paths) {
+        Command command;
+        command.name = path.stem().string();
+        command.audio = read_wav_mono_f32(path.string(), WHISPER_SAMPLE_RATE);
+
+        auto txt = path;
+        txt.replace_extension(".txt");
+        std::ifstream file(txt);
+        if (file) {
+            std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            command.reference = words(text);
+        }
+
+        commands.push_back(std::move(command));
+    }
+
+    return commands;
+}
+
+// Margin in milliseconds, or -1 for full context.
+void run_adaptive_ctx(const Config &config, Reporter &reporter, const std::string &model,
+        const std::vector<Command> &commands, int32_t margin_ms,
+        std::vector<std::vector<std::string>> &full_transcripts) {
+    auto name = "whisper.adaptive_ctx." + (margin_ms < 0 ? std::string("full") : "margin_" + std::to_string(margin_ms));
+    // Full context is the baseline of the others, and always runs.
+    if (margin_ms >= 0 && !reporter.enabled(name)) {
+        return;
+    }
+
+    std::fprintf(stderr, "running %s with %s\n", name.data(), model.data());
+
+    whisper_params params;
+    params.model = model;
+    params.n_threads = std::clamp(static_cast<int32_t>(std::thread::hardware_concurrency()), 1, 8);
+    params.beam_size = 1;
+    params.no_timestamps = true;
+    params.adaptive_audio_ctx = margin_ms >= 0;
+    params.audio_ctx_margin_ms = std::max(margin_ms, 0);
+
+    WhisperCpp whisper(params);
+
+    auto &registry = MetricsRegistry::instance();
+    auto &accepted = registry.counter("assistant_whisper_adaptive_ctx_total",
+            "Number of requests decoded with adaptive audio context", {{"result", "accepted"}});
+    auto &fallbacks = registry.counter("assistant_whisper_adaptive_ctx_total",
+            "Number of requests decoded with adaptive audio context", {{"result", "fallback"}});
+
+    // Untimed, so that the first command doesn't pay for cold caches.
+    whisper.transcribe(commands.front().audio);
+
+    auto accepted_start = accepted.value();
+    auto fallbacks_start = fallbacks.value();
+
+    std::vector<double> latencies;
+    std::size_t reference_words = 0;
+    std::size_t reference_errors = 0;
+    std::size_t full_words = 0;
+    std::size_t full_errors = 0;
+    std::vector<std::vector<std::string>> transcripts;
+    for (const auto &command : commands) {
+        std::vector<WhisperSegment> segments;
+        latencies.push_back(measure([&]() {
+            segments = whisper.transcribe(command.audio);
+        }) * 1000);
+
+        std::string text;
+        for (const auto &segment : segments) {
+            text += segment.text;
+        }
+        transcripts.push_back(words(text));
+
+        if (!command.reference.empty()) {
+            reference_words += command.reference.size();
+            reference_errors += word_errors(command.reference, transcripts.back());
+        }
+    }
+
+    if (margin_ms < 0) {
+        full_transcripts = transcripts;
+    }
+
+    for (std::size_t idx = 0; idx < transcripts.size(); ++idx) {
+        full_words += full_transcripts[idx].size();
+        full_errors += word_errors(full_transcripts[idx], transcripts[idx]);
+    }
+
+    if (!reporter.enabled(name)) {
+        return;
+    }
+
+    auto adaptive = (accepted.value() - accepted_start) + (fallbacks.value() - fallbacks_start);
+
+    Result result;
+    result.name = std::move(name);
+    result.params.emplace_back("model", model);
+    result.params.emplace_back("commands", std::to_string(commands.size()));
+    result.params.emplace_back("corpus", config.whisper_corpus.empty() ? "generated" : config.whisper_corpus);
+    add_stats(result, "latency_ms", summarize(std::move(latencies)));
+    result.metrics.emplace_back("fallback_ratio",
+            adaptive > 0 ? static_cast<double>(fallbacks.value() - fallbacks_start) / adaptive : 0.0);
+    // Word error rate against reference transcripts, and against transcripts of full context.
+    if (reference_words > 0) {
+        result.metrics.emplace_back("wer", static_cast<double>(reference_errors) / reference_words);
+    }
+    result.metrics.emplace_back("wer_vs_full", full_words > 0 ? static_cast<double>(full_errors) / full_words : 0.0);
+    reporter.add(std::move(result));
+}
+
+}
+
+void whisper_benchmark(const Config &config, Reporter &reporter) {
+    if (config.whisper_models.empty() || !reporter.enabled("whisper.")) {
+        return;
+    }
+
+    auto audio = make_audio(WHISPER_SAMPLE_RATE, config.whisper_seconds);
+    std::vector<uint8_t> wav(audio.size() * sizeof(int16_t));
+    pcm::from_mono_f32(audio.data(), audio.size(), AUDIO_S16SYS, 1, wav.data());
+
+    for (const auto &model : config.whisper_models) {
+        for (const auto &whisper_config : whisper_configs()) {
+            run(config, reporter, model, whisper_config, wav);
+        }
+
+        run_startup(config, reporter, model, 0, wav);
+        run_startup(config, reporter, model, 1000, wav);
+    }
+
+    if (!reporter.enabled("whisper.adaptive_ctx.")) {
+        return;
+    }
+
+    auto commands = load_commands(config.whisper_corpus);
+    if (commands.empty()) {
+        std::fprintf(stderr, "no WAV file in %s\n", config.whisper_corpus.data());
+        return;
+    }
+
+    for (const auto &model : config.whisper_models) {
+        std::vector<std::vector<std::string>> full_transcripts;
+        for (auto margin_ms : {-1, 250, 500, 1000}) {
+            run_adaptive_ctx(config, reporter, model, commands, margin_ms, full_transcripts);
+        }
+    }
+}
+
+}
@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2023 sewenew
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Long-lived faster-whisper worker spawned by sw::assistant::FasterWhisper.
+
+Audio is read from a shared memory fd, split into slots of 16 kHz mono float32 samples.
+Requests and responses are exchanged over stdin/stdout:
+
+    request:  <id> <slot> <samples>\\n
+    response: <id> <ok> <payload size>\\n<payload>
+
+where payload is the transcript if ok is 1, or an error message otherwise.
+The worker writes "ready\\n" once the model is loaded, and exits on EOF of stdin.
+"""
+
+import argparse
+import mmap
+import os
+import select
+import sys
+
+import numpy as np
+from faster_whisper import WhisperModel
+
+
+class RequestReader:
+    def __init__(self, fd):
+        self._fd = fd
+        self._buffer = b""
+        self.eof = False
+
+    def read(self, max_requests):
+        """Block until at least one request arrives, then take whatever else is already queued."""
+        requests = self._parse(max_requests)
+        while not requests and not self.eof:
+            self._fill()
+            requests = self._parse(max_requests)
+
+        while len(requests) < max_requests and not self.eof:
+            ready, _, _ = select.select([self._fd], [], [], 0)
+            if not ready:
+                break
+            self._fill()
+            requests += self._parse(max_requests - len(requests))
+
+        return requests
+
+    def _fill(self):
+        data = os.read(self._fd, 65536)
+        if not data:
+            self.eof = True
+        self._buffer += data
+
+    def _parse(self, max_requests):
+        requests = []
+        while len(requests) < max_requests:
+            pos = self._buffer.find(b"\n")
+            if pos < 0:
+                break
+            line, self._buffer = self._buffer[:pos], self._buffer[pos + 1:]
+            req_id, slot, samples = line.split()
+            requests.append((int(req_id), int(slot), int(samples)))
+        return requests
+
+
+def write_response(req_id, ok, payload):
+    data = payload.encode("utf-8")
+    header = "{} {} {}\n".format(req_id, 1 if ok else 0, len(data)).encode("utf-8")
+    os.write(1, header + data)
+
+
+def transcribe(model, audio, args):
+    segments, _ = model.transcribe(audio, beam_size=args.beam_size, language=args.language or None)
+    return "".join(segment.text for segment in segments)
+
+
+def transcribe_batch(model, audios, args):
+    """Decode several requests, each no longer than 30 seconds, with a single generate call."""
+    from faster_whisper.tokenizer import Tokenizer
+
+    extractor = model.feature_extractor
+    features = []
+    for audio in audios:
+        feature = extractor(audio)[:, :extractor.nb_max_frames]
+        padding = extractor.nb_max_frames - feature.shape[-1]
+        features.append(np.pad(feature, ((0, 0), (0, padding))))
+
+    tokenizer = Tokenizer(model.hf_tokenizer, model.model.is_multilingual,
+                          task="transcribe", language=args.language)
+    prompt = model.get_prompt(tokenizer, [], without_timestamps=True)
+    encoder_output = model.encode(np.stack(features).astype(np.float32))
+    results = model.model.generate(encoder_output, [prompt] * len(audios),
+                                   beam_size=args.beam_size, max_length=model.max_length)
+
+    return [tokenizer.decode([t for t in result.sequences_ids[0] if t < tokenizer.eot])
+            for result in results]
+
+
+def handle(model, shm, requests, args):
+    audios = []
+    for req_id, slot, samples in requests:
+        offset = slot * args.slot_samples * 4
+        audios.append(np.frombuffer(shm, dtype=np.float32, count=samples, offset=offset))
+
+    texts = None
+    # Batching needs a fixed language, since language detection is per audio.
+    if len(requests) > 1 and args.language:
+        try:
+            texts = transcribe_batch(model, audios, args)
+        except Exception as e:
+            print("batched transcription failed, fall back to sequential: {}".format(e), file=sys.stderr)
+
+    for idx, (req_id, _, _) in enumerate(requests):
+        try:
+            text = texts[idx] if texts is not None else transcribe(model, audios[idx], args)
+            write_response(req_id, True, text)
+        except Exception as e:
+            write_response(req_id, False, str(e))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--model", default="base")
+    parser.add_argument("--device", default="cpu")
+    parser.add_argument("--compute-type", default="int8")
+    parser.add_argument("--language", default="")
+    parser.add_argument("--beam-size", type=int, default=5)
+    parser.add_argument("--shm-fd", type=int, required=True)
+    parser.add_argument("--slots", type=int, required=True)
+    parser.add_argument("--slot-samples", type=int, required=True)
+    parser.add_argument("--max-batch", type=int, default=8)
+    args = parser.parse_args()
+
+    model = WhisperModel(args.model, device=args.device, compute_type=args.compute_type)
+    shm = mmap.mmap(args.shm_fd, args.slots * args.slot_samples * 4, access=mmap.ACCESS_READ)
+
+    os.write(1, b"ready\n")
+
+    reader = RequestReader(0)
+    while True:
+        requests = reader.read(args.max_batch)
+        if not requests:
+            break
+        handle(model, shm, requests, args)
+
+
+if __name__ == "__main__":
+    main()
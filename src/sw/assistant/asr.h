@@ -17,17 +17,97 @@
 #ifndef SEWENEW_ASSISTANT_ASR_H
 #define SEWENEW_ASSISTANT_ASR_H
 
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
 #include <string>
 #include <vector>
+#include "sw/assistant/pcm.h"
+#include "sw/assistant/span.h"
 #include "sw/assistant/wav.h"
 
 namespace sw::assistant {
 
+// Non-owning view of interleaved audio samples, e.g. a slice of a capture ring buffer,
+// or samples of an mmapped WAV file. The viewed memory should outlive the view.
+class AudioView {
+public:
+    AudioView() = default;
+
+    // Raw bytes of the given format.
+    AudioView(Span<const uint8_t> data, const WavOptions &opts) :
+        _data(data.data()), _bytes(data.size()), _options(opts) {}
+
+    // Typed samples, i.e. uint8_t, int16_t, int32_t or float.
+    template <typename T>
+    AudioView(Span<const T> samples, uint32_t sample_rate, uint16_t channels = 1) :
+        _data(samples.data()), _bytes(samples.size_bytes()) {
+        _options.channels = channels;
+        _options.sample_per_second = sample_rate;
+        _options.format = pcm::format_of<T>();
+    }
+
+    explicit AudioView(const WavReader &reader) : AudioView(reader.data(), reader.options()) {}
+
+    const void* data() const {
+        return _data;
+    }
+
+    std::size_t bytes() const {
+        return _bytes;
+    }
+
+    // Format of samples, and number of interleaved channels and sample rate.
+    const WavOptions& options() const {
+        return _options;
+    }
+
+    // Number of frames, i.e. samples per channel. Trailing partial frame is ignored.
+    std::size_t frames() const {
+        return _bytes / (pcm::sample_size(_options.format) * _options.channels);
+    }
+
+private:
+    const void *_data = nullptr;
+
+    std::size_t _bytes = 0;
+
+    WavOptions _options;
+};
+
+// Called with the recognized text, or an exception if it failed.
+using AsrCallback = std::function<void (std::string text, std::exception_ptr err)>;
+
 class Asr {
 public:
     virtual ~Asr() = default;
 
-    virtual std::string recognize(const std::vector<uint8_t> &wav, const WavOptions &opts) = 0;
+    virtual std::string recognize(const AudioView &audio) = 0;
+
+    std::string recognize(const std::vector<uint8_t> &wav, const WavOptions &opts) {
+        return recognize(AudioView(wav, opts));
+    }
+
+    // Recognize without blocking on decoding. `callback` is called from the backend's thread,
+    // so it should be short. Unless the backend states otherwise, audio should be valid until
+    // callback is called.
+    virtual void recognize_async(const AudioView &audio, AsrCallback callback) = 0;
+
+    std::future<std::string> recognize_async(const AudioView &audio) {
+        auto promise = std::make_shared<std::promise<std::string>>();
+        auto future = promise->get_future();
+        recognize_async(audio, [promise](std::string text, std::exception_ptr err) {
+            if (err) {
+                promise->set_exception(err);
+            } else {
+                promise->set_value(std::move(text));
+            }
+        });
+
+        return future;
+    }
 };
 
 }
@@ -17,12 +17,18 @@
 #include "sw/assistant/audio_player.h"
 #include "sw/assistant/audio_utils.h"
 #include "sw/assistant/errors.h"
+#include "sw/assistant/pcm.h"
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <thread>
 #include <SDL2/SDL.h>
 
 namespace sw::assistant {
 
-AudioPlayer::AudioPlayer(const AudioPlayerOptions &options) {
+AudioPlayer::AudioPlayer(const AudioPlayerOptions &options) :
+    _underrun_metric(MetricsRegistry::instance().counter("assistant_player_underruns_total",
+                "Number of playback callbacks that found the ring buffer starved")) {
     auto desired_spec = _to_spec(options);
 
     const char *device_name = nullptr;
@@ -33,11 +39,47 @@ AudioPlayer::AudioPlayer(const AudioPlayerOptions &options) {
     _device_id = SDL_OpenAudioDevice(device_name, SDL_FALSE,
             &desired_spec, &_audio_spec, options.allowed_changes);
     if (_device_id == 0) {
-        throw SDLError("failed to open recording device");
+        throw SDLError("failed to open playback device");
+    }
+
+    if (options.ring_buffer.count() > 0) {
+        auto size = static_cast<uint64_t>(_bytes_per_second()) * options.ring_buffer.count() / 1000;
+        // Ring buffer should be able to hold at least one callback's worth of audio.
+        _ring = std::make_unique<RingBuffer<uint8_t>>(std::max<uint64_t>(size, _audio_spec.size));
+    }
+}
+
+AudioPlayer::~AudioPlayer() {
+    if (_device_id != 0) {
+        // Closing the device waits for the running callback, if any.
+        SDL_CloseAudioDevice(_device_id);
     }
 }
 
 void AudioPlayer::play(const std::vector<uint8_t> &wav) {
+    if (_ring) {
+        start();
+
+        auto *data = wav.data();
+        auto size = wav.size();
+        // Refill the ring buffer every half of a callback period.
+        auto period = std::chrono::milliseconds(std::max<uint32_t>(_calc_duration(_audio_spec.size) / 2, 1));
+        while (size > 0) {
+            auto written = write(data, size);
+            data += written;
+            size -= written;
+            if (size > 0) {
+                std::this_thread::sleep_for(period);
+            }
+        }
+
+        finish().wait();
+
+        stop();
+
+        return;
+    }
+
     auto duration = _calc_duration(wav.size());
 
     SDL_PauseAudioDevice(_device_id, SDL_FALSE);
@@ -49,7 +91,102 @@ void AudioPlayer::play(const std::vector<uint8_t> &wav) {
     SDL_PauseAudioDevice(_device_id, SDL_TRUE);
 }
 
-SDL_AudioSpec AudioPlayer::_to_spec(const AudioPlayerOptions &options) const {
+void AudioPlayer::play(Span<const float> audio) {
+    _buffer.resize(audio.size() * _audio_spec.channels * pcm::sample_size(_audio_spec.format));
+    pcm::from_mono_f32(audio.data(), audio.size(), _audio_spec.format, _audio_spec.channels, _buffer.data());
+
+    play(_buffer);
+}
+
+void AudioPlayer::start() {
+    _ring_buffer();
+
+    SDL_PauseAudioDevice(_device_id, SDL_FALSE);
+}
+
+std::size_t AudioPlayer::write(const uint8_t *data, std::size_t size) {
+    auto written = _ring_buffer().write(data, size);
+    if (written > 0) {
+        _streaming.store(true, std::memory_order_release);
+    }
+
+    return written;
+}
+
+std::size_t AudioPlayer::writable() const {
+    auto &ring = _ring_buffer();
+
+    return ring.capacity() - ring.size();
+}
+
+std::future<void> AudioPlayer::finish() {
+    _ring_buffer();
+
+    if (_finishing.load(std::memory_order_acquire)) {
+        throw Error("playback is already finishing");
+    }
+
+    // The callback doesn't touch the promise until `_finishing` is set.
+    _finished = std::promise<void>();
+    auto future = _finished.get_future();
+
+    _finishing.store(true, std::memory_order_release);
+
+    return future;
+}
+
+void AudioPlayer::stop() {
+    auto &ring = _ring_buffer();
+
+    // With the device locked, the callback is not running, so that we can take over the consumer side.
+    SDL_LockAudioDevice(_device_id);
+
+    SDL_PauseAudioDevice(_device_id, SDL_TRUE);
+
+    ring.clear();
+
+    _streaming.store(false, std::memory_order_relaxed);
+
+    if (_finishing.load(std::memory_order_acquire)) {
+        _complete();
+    }
+
+    SDL_UnlockAudioDevice(_device_id);
+}
+
+void AudioPlayer::_callback(void *user_data, uint8_t *stream, int len) {
+    auto *player = static_cast<AudioPlayer *>(user_data);
+    assert(player != nullptr && player->_ring);
+
+    // Runs on SDL's audio thread: never block or allocate here.
+    auto size = static_cast<std::size_t>(len);
+    auto num = player->_ring->read(stream, size);
+    if (num == size) {
+        return;
+    }
+
+    std::memset(stream + num, player->_audio_spec.silence, size - num);
+
+    if (player->_finishing.load(std::memory_order_acquire)) {
+        // Wait until the callback, which handed the last piece of audio to the device, has returned.
+        if (num == 0) {
+            player->_streaming.store(false, std::memory_order_relaxed);
+            player->_complete();
+        }
+    } else if (player->_streaming.load(std::memory_order_acquire)) {
+        player->_underruns.fetch_add(1, std::memory_order_relaxed);
+        player->_underrun_metric.add();
+    }
+}
+
+void AudioPlayer::_complete() {
+    _finished.set_value();
+
+    // Reset the flag after the promise is fulfilled, so that `finish` won't replace it in the meantime.
+    _finishing.store(false, std::memory_order_release);
+}
+
+SDL_AudioSpec AudioPlayer::_to_spec(const AudioPlayerOptions &options) {
     SDL_AudioSpec desired_spec;
     SDL_zero(desired_spec);
 
@@ -57,16 +194,35 @@ SDL_AudioSpec AudioPlayer::_to_spec(const AudioPlayerOptions &options) const {
     desired_spec.format = options.format;
     desired_spec.channels = options.channels;
     desired_spec.samples = options.samples;
-    desired_spec.callback = nullptr;//_callback;
-    //desired_spec.userdata = this;
+    if (options.ring_buffer.count() > 0) {
+        desired_spec.callback = _callback;
+        desired_spec.userdata = this;
+    } else {
+        // Use SDL's audio queue, i.e. SDL_QueueAudio.
+        desired_spec.callback = nullptr;
+    }
 
     return desired_spec;
 }
 
 uint32_t AudioPlayer::_calc_duration(uint32_t size) const {
+    // In milliseconds, rounded up, so that the tail of a short clip is not cut off.
+    auto bytes_per_second = static_cast<uint64_t>(_bytes_per_second());
+    return static_cast<uint32_t>((static_cast<uint64_t>(size) * 1000 + bytes_per_second - 1) / bytes_per_second);
+}
+
+uint32_t AudioPlayer::_bytes_per_second() const {
     auto bytes_per_sample = SDL_AUDIO_BITSIZE(_audio_spec.format) / 8;
-    auto bytes_per_second = bytes_per_sample * _audio_spec.channels * _audio_spec.freq;
-    return static_cast<uint32_t>(size / bytes_per_second) * 1000;
+
+    return bytes_per_sample * _audio_spec.channels * _audio_spec.freq;
+}
+
+RingBuffer<uint8_t>& AudioPlayer::_ring_buffer() const {
+    if (!_ring) {
+        throw Error("ring buffer is not enabled, set AudioPlayerOptions::ring_buffer");
+    }
+
+    return *_ring;
 }
 
 }
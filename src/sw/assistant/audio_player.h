@@ -17,10 +17,16 @@
 #ifndef SEWENEW_ASSISTANT_AUDIO_PLAYER_H
 #define SEWENEW_ASSISTANT_AUDIO_PLAYER_H
 
+#include <atomic>
 #include <chrono>
+#include <future>
+#include <memory>
 #include <string>
 #include <vector>
 #include <SDL2/SDL.h>
+#include "sw/assistant/metrics.h"
+#include "sw/assistant/ring_buffer.h"
+#include "sw/assistant/span.h"
 
 namespace sw::assistant {
 
@@ -31,22 +37,96 @@ struct AudioPlayerOptions {
     uint8_t channels = 2;
     uint16_t samples = 4096;
     int allowed_changes = 0;
+
+    // If it's 0, `play` queues audio with SDL's audio queue. Otherwise, audio is pulled by
+    // SDL's audio callback from a preallocated ring buffer, which can hold at least `ring_buffer`
+    // of audio, and can be streamed with `start`, `write`, `finish` and `stop`.
+    std::chrono::milliseconds ring_buffer{0};
 };
 
 class AudioPlayer {
 public:
     explicit AudioPlayer(const AudioPlayerOptions &options = {});
 
+    AudioPlayer(const AudioPlayer &) = delete;
+    AudioPlayer& operator=(const AudioPlayer &) = delete;
+
+    AudioPlayer(AudioPlayer &&) = delete;
+    AudioPlayer& operator=(AudioPlayer &&) = delete;
+
+    ~AudioPlayer();
+
+    const SDL_AudioSpec spec() const {
+        return _audio_spec;
+    }
+
+    // Block until the whole audio has been played.
     void play(const std::vector<uint8_t> &data);
 
+    // Play mono float32 audio sampled at the device's frequency.
+    // It's converted to the device's format and channels before playing.
+    void play(Span<const float> audio);
+
+    // The following methods only work in ring buffer mode, i.e. AudioPlayerOptions::ring_buffer > 0.
+    // `write` should be called by a single producer thread.
+
+    // Start playback. Audio written afterwards is played as soon as it arrives,
+    // and silence is played while the ring buffer is empty.
+    void start();
+
+    // Non-blocking. Returns the number of bytes accepted, which is less than `size`
+    // if the ring buffer is full. Retry the rest after the player drained some audio.
+    std::size_t write(const uint8_t *data, std::size_t size);
+
+    // Number of bytes that can be written without being truncated.
+    std::size_t writable() const;
+
+    // Mark the end of the written audio. The returned future becomes ready once all
+    // written audio has been handed to the device, or playback is stopped.
+    std::future<void> finish();
+
+    // Stop playback immediately and discard buffered audio, e.g. when user barges in.
+    void stop();
+
+    // Number of callbacks that found the ring buffer starved before `finish` was called.
+    uint64_t underruns() const {
+        return _underruns.load(std::memory_order_relaxed);
+    }
+
 private:
-    SDL_AudioSpec _to_spec(const AudioPlayerOptions &options) const;
+    static void _callback(void *user_data, uint8_t *stream, int len);
+
+    SDL_AudioSpec _to_spec(const AudioPlayerOptions &options);
 
     uint32_t _calc_duration(uint32_t size) const;
 
+    uint32_t _bytes_per_second() const;
+
+    RingBuffer<uint8_t>& _ring_buffer() const;
+
+    // Fulfill the pending `finish` future. Called with the device locked or from the callback.
+    void _complete();
+
     SDL_AudioSpec _audio_spec;
 
     int _device_id = 0;
+
+    // Audio converted to the device's format, reused to avoid allocation per call.
+    std::vector<uint8_t> _buffer;
+
+    std::unique_ptr<RingBuffer<uint8_t>> _ring;
+
+    // Whether audio has been written since `start`, i.e. an empty ring buffer is an underrun.
+    std::atomic<bool> _streaming{false};
+
+    // Whether `finish` has been called, and `_finished` is waiting to be fulfilled.
+    std::atomic<bool> _finishing{false};
+
+    std::promise<void> _finished;
+
+    std::atomic<uint64_t> _underruns{0};
+
+    Counter &_underrun_metric;
 };
 
 }
@@ -17,6 +17,7 @@
 #include "sw/assistant/audio_recorder.h"
 #include "sw/assistant/audio_utils.h"
 #include "sw/assistant/errors.h"
+#include <algorithm>
 #include <cassert>
 #include <SDL2/SDL.h>
 #include <iostream>
@@ -24,7 +25,9 @@
 
 namespace sw::assistant {
 
-AudioRecorder::AudioRecorder(const AudioRecorderOptions &options) {
+AudioRecorder::AudioRecorder(const AudioRecorderOptions &options) :
+    _overrun_metric(MetricsRegistry::instance().counter("assistant_recorder_overrun_bytes_total",
+                "Number of captured bytes dropped because the ring buffer was full")) {
     auto desired_spec = _to_spec(options);
 
     const char *device_name = nullptr;
@@ -37,9 +40,25 @@ AudioRecorder::AudioRecorder(const AudioRecorderOptions &options) {
     if (_device_id == 0) {
         throw SDLError("failed to open recording device");
     }
+
+    if (options.ring_buffer.count() > 0) {
+        auto size = static_cast<uint64_t>(_bytes_per_second()) * options.ring_buffer.count() / 1000;
+        // Ring buffer should be able to hold at least one callback's worth of audio.
+        _ring = std::make_unique<RingBuffer<uint8_t>>(std::max<uint64_t>(size, _audio_spec.size));
+    }
+}
+
+AudioRecorder::~AudioRecorder() {
+    if (_device_id != 0) {
+        SDL_CloseAudioDevice(_device_id);
+    }
 }
 
 std::vector<uint8_t> AudioRecorder::record(const std::chrono::seconds &duration) {
+    if (_ring) {
+        throw Error("cannot record with ring buffer mode, use start/peek/consume instead");
+    }
+
     auto precision = std::chrono::milliseconds(10);
     if (duration < precision) {
         // TODO: throw error.
@@ -75,12 +94,49 @@ std::vector<uint8_t> AudioRecorder::record(const std::chrono::seconds &duration)
     return buffer;
 }
 
-/*
+WavOptions AudioRecorder::options() const {
+    WavOptions opts;
+    opts.channels = _audio_spec.channels;
+    opts.sample_per_second = static_cast<uint32_t>(_audio_spec.freq);
+    opts.format = _audio_spec.format;
+
+    return opts;
+}
+
+void AudioRecorder::start() {
+    _ring_buffer();
+
+    SDL_PauseAudioDevice(_device_id, SDL_FALSE);
+}
+
+void AudioRecorder::stop() {
+    _ring_buffer();
+
+    SDL_PauseAudioDevice(_device_id, SDL_TRUE);
+}
+
+AudioRegions AudioRecorder::peek() {
+    return _ring_buffer().peek();
+}
+
+void AudioRecorder::consume(std::size_t size) {
+    _ring_buffer().consume(size);
+}
+
 void AudioRecorder::_callback(void *user_data, uint8_t *stream, int len) {
+    auto *recorder = static_cast<AudioRecorder *>(user_data);
+    assert(recorder != nullptr && recorder->_ring);
+
+    // Runs on SDL's audio thread: never block or allocate here.
+    auto size = static_cast<std::size_t>(len);
+    auto written = recorder->_ring->write(stream, size);
+    if (written < size) {
+        recorder->_overruns.fetch_add(size - written, std::memory_order_relaxed);
+        recorder->_overrun_metric.add(size - written);
+    }
 }
-*/
 
-SDL_AudioSpec AudioRecorder::_to_spec(const AudioRecorderOptions &options) const {
+SDL_AudioSpec AudioRecorder::_to_spec(const AudioRecorderOptions &options) {
     SDL_AudioSpec desired_spec;
     SDL_zero(desired_spec);
 
@@ -88,19 +144,34 @@ SDL_AudioSpec AudioRecorder::_to_spec(const AudioRecorderOptions &options) const
     desired_spec.format = options.format;
     desired_spec.channels = options.channels;
     desired_spec.samples = options.samples;
-    desired_spec.callback = nullptr;//_callback;
-    //desired_spec.userdata = this;
+    if (options.ring_buffer.count() > 0) {
+        desired_spec.callback = _callback;
+        desired_spec.userdata = this;
+    } else {
+        // Use SDL's audio queue, i.e. SDL_DequeueAudio.
+        desired_spec.callback = nullptr;
+    }
 
     return desired_spec;
 }
 
 uint32_t AudioRecorder::_calc_buffer_size(const std::chrono::seconds &duration) const {
+    // Add 1 second buffer.
+    return _bytes_per_second() * (duration.count() + 1);
+}
+
+uint32_t AudioRecorder::_bytes_per_second() const {
     auto bytes_per_sample = (SDL_AUDIO_MASK_BITSIZE & _audio_spec.format) / 8;
 
-    auto bytes_per_second = bytes_per_sample * _audio_spec.channels * _audio_spec.freq;
+    return bytes_per_sample * _audio_spec.channels * _audio_spec.freq;
+}
 
-    // Add 1 second buffer.
-    return bytes_per_second * (duration.count() + 1);
+RingBuffer<uint8_t>& AudioRecorder::_ring_buffer() const {
+    if (!_ring) {
+        throw Error("ring buffer is not enabled, set AudioRecorderOptions::ring_buffer");
+    }
+
+    return *_ring;
 }
 
 }
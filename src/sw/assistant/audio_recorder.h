@@ -17,9 +17,15 @@
 #ifndef SEWENEW_ASSISTANT_AUDIO_RECORDER_H
 #define SEWENEW_ASSISTANT_AUDIO_RECORDER_H
 
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <string>
+#include <vector>
 #include <SDL2/SDL.h>
+#include "sw/assistant/audio_source.h"
+#include "sw/assistant/metrics.h"
+#include "sw/assistant/ring_buffer.h"
 
 namespace sw::assistant {
 
@@ -30,28 +36,81 @@ struct AudioRecorderOptions {
     uint8_t channels = 2;
     uint16_t samples = 4096;
     int allowed_changes = 0;
+
+    // If it's 0, audio is captured with SDL's audio queue, and should be read with `record`.
+    // Otherwise, audio is captured continuously by SDL's audio callback into a preallocated
+    // ring buffer, which can hold at least `ring_buffer` of audio, and should be read with
+    // `start`, `peek`, `consume` and `stop`.
+    std::chrono::milliseconds ring_buffer{0};
 };
 
-class AudioRecorder {
+// As an AudioSource, it should be in ring buffer mode.
+class AudioRecorder : public AudioSource {
 public:
     explicit AudioRecorder(const AudioRecorderOptions &options = {});
 
+    AudioRecorder(const AudioRecorder &) = delete;
+    AudioRecorder& operator=(const AudioRecorder &) = delete;
+
+    AudioRecorder(AudioRecorder &&) = delete;
+    AudioRecorder& operator=(AudioRecorder &&) = delete;
+
+    ~AudioRecorder() override;
+
     const SDL_AudioSpec spec() const {
         return _audio_spec;
     }
 
+    WavOptions options() const override;
+
     std::vector<uint8_t> record(const std::chrono::seconds &duration);
 
+    // The following methods only work in ring buffer mode, i.e. AudioRecorderOptions::ring_buffer > 0.
+
+    // Start continuous capture. Captured audio is appended to the ring buffer by SDL's audio thread.
+    void start() override;
+
+    void stop() override;
+
+    // Returns captured audio without copying. The regions are valid until `consume` is called.
+    // NOTE: peek and consume should be called by a single consumer thread.
+    AudioRegions peek() override;
+
+    void consume(std::size_t size) override;
+
+    bool live() const override {
+        return true;
+    }
+
+    bool finished() const override {
+        return false;
+    }
+
+    // Number of bytes dropped, because the consumer didn't keep up and the ring buffer was full.
+    uint64_t overruns() const {
+        return _overruns.load(std::memory_order_relaxed);
+    }
+
 private:
-    //static void _callback(void *user_data, uint8_t *stream, int len);
+    static void _callback(void *user_data, uint8_t *stream, int len);
 
-    SDL_AudioSpec _to_spec(const AudioRecorderOptions &options) const;
+    SDL_AudioSpec _to_spec(const AudioRecorderOptions &options);
 
     uint32_t _calc_buffer_size(const std::chrono::seconds &duration) const;
 
+    uint32_t _bytes_per_second() const;
+
+    RingBuffer<uint8_t>& _ring_buffer() const;
+
     SDL_AudioSpec _audio_spec;
 
     int _device_id = 0;
+
+    std::unique_ptr<RingBuffer<uint8_t>> _ring;
+
+    std::atomic<uint64_t> _overruns{0};
+
+    Counter &_overrun_metric;
 };
 
 }
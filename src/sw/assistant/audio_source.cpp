@@ -0,0 +1,50 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/audio_source.h"
+#include <limits>
+#include "sw/assistant/errors.h"
+#include "sw/assistant/pcm.h"
+
+namespace sw::assistant {
+
+AudioPacer::AudioPacer(double speed, const WavOptions &opts) :
+    _speed(speed), _frame_size(pcm::sample_size(opts.format) * opts.channels) {
+    if (speed < 0.0 || _frame_size == 0 || opts.sample_per_second == 0) {
+        throw Error("invalid audio pacer options");
+    }
+
+    _bytes_per_second = static_cast<double>(_frame_size) * opts.sample_per_second;
+}
+
+void AudioPacer::start() {
+    _start = std::chrono::steady_clock::now();
+    _delivered = 0;
+}
+
+uint64_t AudioPacer::available() const {
+    if (_speed == 0.0) {
+        return std::numeric_limits<uint64_t>::max() / 2;
+    }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+    auto frames = static_cast<uint64_t>(elapsed * _speed * _bytes_per_second) / _frame_size;
+    auto total = frames * _frame_size;
+
+    return total > _delivered ? total - _delivered : 0;
+}
+
+}
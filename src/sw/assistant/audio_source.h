@@ -0,0 +1,83 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_AUDIO_SOURCE_H
+#define SEWENEW_ASSISTANT_AUDIO_SOURCE_H
+
+#include <chrono>
+#include <cstdint>
+#include "sw/assistant/ring_buffer.h"
+#include "sw/assistant/wav.h"
+
+namespace sw::assistant {
+
+using AudioRegions = RingBuffer<uint8_t>::Regions;
+
+// Continuous source of interleaved PCM audio, e.g. a recording device, a WAV file, or generated audio.
+// Audio is read with `peek` and `consume` by a single consumer thread between `start` and `stop`.
+class AudioSource {
+public:
+    virtual ~AudioSource() = default;
+
+    virtual WavOptions options() const = 0;
+
+    virtual void start() = 0;
+
+    virtual void stop() = 0;
+
+    // Returns available audio without copying. The regions are valid until `consume` is called.
+    virtual AudioRegions peek() = 0;
+
+    virtual void consume(std::size_t size) = 0;
+
+    // Live sources, e.g. a recording device, don't wait for the consumer,
+    // i.e. audio is lost if it's not consumed in time.
+    virtual bool live() const = 0;
+
+    // No more audio, e.g. end of file. Live sources never finish.
+    virtual bool finished() const = 0;
+};
+
+// Makes audio of non-live sources available at `speed` times real time, e.g. 50 for 50x.
+// If speed is 0, audio is available as fast as it's consumed.
+class AudioPacer {
+public:
+    AudioPacer(double speed, const WavOptions &opts);
+
+    void start();
+
+    // Number of bytes, in whole frames, that can be delivered now.
+    uint64_t available() const;
+
+    void consume(std::size_t size) {
+        _delivered += size;
+    }
+
+private:
+    double _speed = 1.0;
+
+    double _bytes_per_second = 0.0;
+
+    std::size_t _frame_size = 0;
+
+    std::chrono::steady_clock::time_point _start;
+
+    uint64_t _delivered = 0;
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_AUDIO_SOURCE_H
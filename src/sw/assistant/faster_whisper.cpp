@@ -15,32 +15,423 @@
  *************************************************************************/
 
 #include "sw/assistant/faster_whisper.h"
+#include <cerrno>
 #include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "sw/assistant/errors.h"
+#include "sw/assistant/pcm.h"
+#include "sw/assistant/resampler.h"
+
+extern char **environ;
 
 namespace sw::assistant {
 
-std::string FasterWhisper::recognize(const std::vector<uint8_t> &wav, const WavOptions &opts) {
-    WavWriter writer;
-    writer.write("test.wav", opts, wav);
-    std::string cmd = "python " + _asr_py;
-    auto *pipe = popen(cmd.data(), "r");
-    if (pipe == nullptr) {
-        throw Error("failed to open asr.py");
+namespace {
+
+// faster-whisper takes 16 kHz mono float32 audio.
+constexpr int SAMPLE_RATE = 16000;
+
+// Descriptor of the shared memory in the worker, i.e. the first one after stdio.
+constexpr int WORKER_SHM_FD = 3;
+
+Error sys_error(const std::string &msg) {
+    return Error(msg + ": " + std::strerror(errno));
+}
+
+FasterWhisperOptions worker_options(const std::string &worker) {
+    FasterWhisperOptions opts;
+    opts.worker = worker;
+    return opts;
+}
+
+}
+
+FasterWhisper::FasterWhisper(const FasterWhisperOptions &opts) :
+    _round_trip_time(MetricsRegistry::instance().histogram("assistant_faster_whisper_round_trip_seconds",
+                "Time since a request is sent to faster-whisper worker until its response is received")),
+    _wait_time(MetricsRegistry::instance().histogram("assistant_faster_whisper_wait_seconds",
+                "Time waiting for a free faster-whisper shared memory slot")),
+    _errors(MetricsRegistry::instance().counter("assistant_faster_whisper_errors_total",
+                "Number of failed faster-whisper requests")) {
+    if (opts.worker.empty()) {
+        throw Error("faster-whisper worker script is not specified");
     }
-    std::string result;
-    std::array<char, 1024> buffer;
-    while (true) {
-        auto num = fread(buffer.data(), sizeof(char), buffer.size(), pipe);
-        if (num > 0) {
-            result += std::string(buffer.data(), num);
-        } else {
+
+    if (opts.slots == 0 || opts.max_audio.count() <= 0 || opts.max_batch <= 0) {
+        throw Error("invalid faster-whisper options");
+    }
+
+    try {
+        _init_shm(opts);
+        _spawn(opts);
+        _wait_ready();
+    } catch (...) {
+        _shutdown();
+        throw;
+    }
+
+    for (auto slot = opts.slots; slot > 0; --slot) {
+        _free_slots.push_back(slot - 1);
+    }
+    _slot_buffers.resize(opts.slots);
+
+    _reader = std::thread([this]() { _read_responses(); });
+}
+
+FasterWhisper::FasterWhisper(const std::string &worker) : FasterWhisper(worker_options(worker)) {}
+
+FasterWhisper::~FasterWhisper() {
+    _shutdown();
+}
+
+std::string FasterWhisper::recognize(const AudioView &audio) {
+    return recognize_async(audio).get();
+}
+
+void FasterWhisper::recognize_async(const AudioView &audio, AsrCallback callback) {
+    if (audio.options().channels == 0) {
+        throw Error("invalid channel number");
+    }
+
+    auto slot = _acquire_slot();
+    std::size_t samples = 0;
+    try {
+        samples = _load(slot, audio);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _release_slot(slot);
+        throw;
+    }
+
+    uint64_t id = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_broken.empty()) {
+            _release_slot(slot);
+            throw Error(_broken);
+        }
+
+        id = _next_id++;
+        Request request;
+        request.slot = slot;
+        request.callback = std::move(callback);
+        request.start = std::chrono::steady_clock::now();
+        _pending.emplace(id, std::move(request));
+    }
+
+    try {
+        _send(std::to_string(id) + " " + std::to_string(slot) + " " + std::to_string(samples) + "\n");
+    } catch (...) {
+        // The callback has been called with the error.
+        _fail_all("failed to send request to faster-whisper worker");
+    }
+}
+
+std::size_t FasterWhisper::_load(std::size_t slot, const AudioView &audio) {
+    const auto &opts = audio.options();
+    auto frames = audio.frames();
+
+    // Convert, and resample if necessary, straight into the shared memory slot.
+    auto *dst = _shm + slot * _slot_samples;
+    if (opts.sample_per_second == SAMPLE_RATE) {
+        if (frames > _slot_samples) {
+            throw Error("audio is too long for faster-whisper");
+        }
+
+        return pcm::to_mono_f32(audio.data(), audio.bytes(), opts.format, opts.channels, dst);
+    }
+
+    // The slot is owned by this request, and so are its buffers.
+    auto &buffers = _slot_buffers[slot];
+    auto &resampler = buffers.resampler;
+    if (!resampler || resampler->in_rate() != static_cast<int>(opts.sample_per_second)) {
+        resampler = std::make_unique<Resampler>(opts.sample_per_second, SAMPLE_RATE);
+    }
+
+    if (resampler->max_output(frames) + resampler->max_output(0) > _slot_samples) {
+        throw Error("audio is too long for faster-whisper");
+    }
+
+    auto &mono = buffers.mono;
+    mono.resize(frames);
+    pcm::to_mono_f32(audio.data(), audio.bytes(), opts.format, opts.channels, mono.data());
+
+    auto samples = resampler->process(mono, dst);
+    samples += resampler->flush(dst + samples);
+
+    return samples;
+}
+
+void FasterWhisper::_init_shm(const FasterWhisperOptions &opts) {
+    _slot_samples = static_cast<std::size_t>(opts.max_audio.count()) * SAMPLE_RATE;
+    _shm_size = opts.slots * _slot_samples * sizeof(float);
+
+    // Close-on-exec, so that other children, e.g. other workers, don't get a writable mapping
+    // of our audio. Only the worker inherits it, see `_spawn`.
+    _shm_fd = memfd_create("faster_whisper", MFD_CLOEXEC);
+    if (_shm_fd < 0) {
+        throw sys_error("failed to create shared memory");
+    }
+
+    if (_shm_fd == WORKER_SHM_FD) {
+        // dup2 to itself doesn't clear close-on-exec on older libc, so move it out of the way.
+        auto fd = fcntl(_shm_fd, F_DUPFD_CLOEXEC, WORKER_SHM_FD + 1);
+        close(_shm_fd);
+        _shm_fd = fd;
+        if (_shm_fd < 0) {
+            throw sys_error("failed to duplicate shared memory descriptor");
+        }
+    }
+
+    if (ftruncate(_shm_fd, _shm_size) != 0) {
+        throw sys_error("failed to resize shared memory");
+    }
+
+    auto *addr = mmap(nullptr, _shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, _shm_fd, 0);
+    if (addr == MAP_FAILED) {
+        throw sys_error("failed to map shared memory");
+    }
+
+    _shm = static_cast<float *>(addr);
+}
+
+void FasterWhisper::_spawn(const FasterWhisperOptions &opts) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        throw sys_error("failed to create socket pair");
+    }
+
+    _fd = fds[0];
+
+    std::vector<std::string> args = {
+        opts.python, opts.worker,
+        "--model", opts.model,
+        "--device", opts.device,
+        "--compute-type", opts.compute_type,
+        "--language", opts.language,
+        "--beam-size", std::to_string(opts.beam_size),
+        "--shm-fd", std::to_string(WORKER_SHM_FD),
+        "--slots", std::to_string(opts.slots),
+        "--slot-samples", std::to_string(_slot_samples),
+        "--max-batch", std::to_string(opts.max_batch)
+    };
+    std::vector<char *> argv;
+    argv.reserve(args.size() + 1);
+    for (auto &arg : args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    // The duplicate is not close-on-exec, i.e. only the worker inherits the shared memory.
+    posix_spawn_file_actions_adddup2(&actions, _shm_fd, WORKER_SHM_FD);
+
+    auto err = posix_spawnp(&_pid, opts.python.data(), &actions, nullptr, argv.data(), environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+
+    if (err != 0) {
+        _pid = -1;
+        errno = err;
+        throw sys_error("failed to spawn faster-whisper worker");
+    }
+}
+
+void FasterWhisper::_wait_ready() {
+    // The worker writes a line once the model has been loaded.
+    std::string line;
+    if (!_read_line(line) || line != "ready") {
+        throw Error("faster-whisper worker failed to start, check its stderr");
+    }
+}
+
+void FasterWhisper::_read_responses() {
+    // Response: <id> <ok> <payload size>\n<payload>
+    std::string line;
+    std::string payload;
+    while (_read_line(line)) {
+        std::istringstream in(line);
+        uint64_t id = 0;
+        int ok = 0;
+        std::size_t size = 0;
+        if (!(in >> id >> ok >> size) || !_read_exactly(size, payload)) {
             break;
         }
+
+        Request request;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto iter = _pending.find(id);
+            if (iter == _pending.end()) {
+                continue;
+            }
+
+            _release_slot(iter->second.slot);
+            request = std::move(iter->second);
+            _pending.erase(iter);
+        }
+
+        _round_trip_time.observe(std::chrono::steady_clock::now() - request.start);
+
+        // Call it without lock, so that it can issue another request.
+        if (ok != 0) {
+            request.callback(std::move(payload), nullptr);
+        } else {
+            _errors.add();
+            request.callback({}, std::make_exception_ptr(Error("faster-whisper failed: " + payload)));
+        }
+    }
+
+    _fail_all("faster-whisper worker exited");
+}
+
+bool FasterWhisper::_read_line(std::string &line) {
+    while (true) {
+        auto pos = _response_buffer.find('\n');
+        if (pos != std::string::npos) {
+            line.assign(_response_buffer, 0, pos);
+            _response_buffer.erase(0, pos + 1);
+            return true;
+        }
+
+        char buf[4096];
+        auto num = read(_fd, buf, sizeof(buf));
+        if (num < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (num <= 0) {
+            return false;
+        }
+
+        _response_buffer.append(buf, num);
+    }
+}
+
+bool FasterWhisper::_read_exactly(std::size_t size, std::string &data) {
+    while (_response_buffer.size() < size) {
+        char buf[4096];
+        auto num = read(_fd, buf, sizeof(buf));
+        if (num < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (num <= 0) {
+            return false;
+        }
+
+        _response_buffer.append(buf, num);
+    }
+
+    data.assign(_response_buffer, 0, size);
+    _response_buffer.erase(0, size);
+
+    return true;
+}
+
+std::size_t FasterWhisper::_acquire_slot() {
+    ScopedTimer timer(_wait_time);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _slot_cv.wait(lock, [this]() { return !_free_slots.empty() || !_broken.empty(); });
+
+    if (!_broken.empty()) {
+        throw Error(_broken);
+    }
+
+    auto slot = _free_slots.back();
+    _free_slots.pop_back();
+
+    return slot;
+}
+
+// NOTE: _mutex should be held.
+void FasterWhisper::_release_slot(std::size_t slot) {
+    _free_slots.push_back(slot);
+    _slot_cv.notify_one();
+}
+
+void FasterWhisper::_send(const std::string &request) {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+
+    std::size_t sent = 0;
+    while (sent < request.size()) {
+        // MSG_NOSIGNAL: report EPIPE instead of raising SIGPIPE if the worker has exited.
+        auto num = ::send(_fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (num < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            throw sys_error("failed to send request to faster-whisper worker");
+        }
+
+        sent += num;
     }
-    pclose(pipe);
+}
+
+void FasterWhisper::_fail_all(const std::string &err) {
+    std::unordered_map<uint64_t, Request> pending;
+    std::string broken;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_broken.empty()) {
+            _broken = err;
+        }
+        broken = _broken;
 
-    return result;
+        pending.swap(_pending);
+    }
+
+    _slot_cv.notify_all();
+
+    for (auto &[id, request] : pending) {
+        _errors.add();
+        request.callback({}, std::make_exception_ptr(Error(broken)));
+    }
+}
+
+void FasterWhisper::_shutdown() {
+    if (_fd >= 0) {
+        // EOF of stdin tells the worker to exit, which then closes its end.
+        shutdown(_fd, SHUT_WR);
+    }
+
+    if (_reader.joinable()) {
+        _reader.join();
+    }
+
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+
+    if (_pid > 0) {
+        waitpid(_pid, nullptr, 0);
+        _pid = -1;
+    }
+
+    if (_shm != nullptr) {
+        munmap(_shm, _shm_size);
+        _shm = nullptr;
+    }
+
+    if (_shm_fd >= 0) {
+        close(_shm_fd);
+        _shm_fd = -1;
+    }
 }
 
 }
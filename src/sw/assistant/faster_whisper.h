@@ -17,20 +17,166 @@
 #ifndef SEWENEW_ASSISTANT_FASTER_WHISPER_H
 #define SEWENEW_ASSISTANT_FASTER_WHISPER_H
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
 #include "sw/assistant/asr.h"
+#include "sw/assistant/metrics.h"
+#include "sw/assistant/resampler.h"
 #include "sw/assistant/wav.h"
 
 namespace sw::assistant {
 
+struct FasterWhisperOptions {
+    // Path of scripts/faster_whisper_worker.py.
+    std::string worker;
+
+    std::string python = "python3";
+
+    // Model size or path passed to faster_whisper.WhisperModel.
+    std::string model = "base";
+
+    std::string device = "cpu";
+
+    std::string compute_type = "int8";
+
+    // Empty for language detection. Requests are only batched when language is specified.
+    std::string language;
+
+    int beam_size = 5;
+
+    // Number of shared memory slots, i.e. max number of in-flight requests.
+    std::size_t slots = 4;
+
+    // Max audio length of a single request.
+    std::chrono::seconds max_audio{30};
+
+    // Max number of queued requests the worker coalesces into one batched call.
+    int max_batch = 8;
+};
+
+// ASR with faster-whisper, running in a long-lived Python worker which loads the model once.
+// Audio is passed as 16 kHz mono float32 through a shared memory (memfd) region split into
+// slots, and requests/responses are framed as lines over a Unix socket bound to the worker's
+// stdin and stdout.
+// It's thread-safe, and concurrent requests might be batched by the worker.
+// `recognize_async` copies audio into shared memory before returning, i.e. audio doesn't need
+// to outlive the call, and it blocks only if all slots are in use. Callbacks are called from
+// the thread reading responses.
 class FasterWhisper : public Asr {
 public:
-    explicit FasterWhisper(const std::string &asr_py) : _asr_py(asr_py) {}
+    explicit FasterWhisper(const FasterWhisperOptions &opts);
+
+    explicit FasterWhisper(const std::string &worker);
+
+    FasterWhisper(const FasterWhisper &) = delete;
+    FasterWhisper& operator=(const FasterWhisper &) = delete;
 
-    std::string recognize(const std::vector<uint8_t> &wav, const WavOptions &opts);
+    FasterWhisper(FasterWhisper &&) = delete;
+    FasterWhisper& operator=(FasterWhisper &&) = delete;
+
+    ~FasterWhisper();
+
+    using Asr::recognize;
+    using Asr::recognize_async;
+
+    std::string recognize(const AudioView &audio) override;
+
+    void recognize_async(const AudioView &audio, AsrCallback callback) override;
 
 private:
-    std::string _asr_py;
+    struct Request {
+        std::size_t slot = 0;
+
+        AsrCallback callback;
+
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // Buffers reused by requests of a slot, for audio which is not at 16 kHz.
+    struct SlotBuffers {
+        std::vector<float> mono;
+
+        std::unique_ptr<Resampler> resampler;
+    };
+
+    // Convert audio into the slot. Returns the number of samples.
+    std::size_t _load(std::size_t slot, const AudioView &audio);
+
+    void _init_shm(const FasterWhisperOptions &opts);
+
+    void _spawn(const FasterWhisperOptions &opts);
+
+    void _wait_ready();
+
+    void _read_responses();
+
+    bool _read_line(std::string &line);
+
+    bool _read_exactly(std::size_t size, std::string &data);
+
+    std::size_t _acquire_slot();
+
+    void _release_slot(std::size_t slot);
+
+    void _send(const std::string &request);
+
+    void _fail_all(const std::string &err);
+
+    void _shutdown();
+
+    pid_t _pid = -1;
+
+    // Our end of the socket pair, whose other end is worker's stdin and stdout.
+    int _fd = -1;
+
+    int _shm_fd = -1;
+
+    float *_shm = nullptr;
+
+    std::size_t _shm_size = 0;
+
+    // Max samples per slot.
+    std::size_t _slot_samples = 0;
+
+    // Bytes read from the socket, but not parsed yet.
+    std::string _response_buffer;
+
+    std::mutex _mutex;
+
+    std::condition_variable _slot_cv;
+
+    std::vector<std::size_t> _free_slots;
+
+    // Indexed by slot.
+    std::vector<SlotBuffers> _slot_buffers;
+
+    uint64_t _next_id = 0;
+
+    // In-flight requests.
+    std::unordered_map<uint64_t, Request> _pending;
+
+    // Set when the worker exits or the socket breaks, and all requests fail afterwards.
+    std::string _broken;
+
+    std::mutex _write_mutex;
+
+    std::thread _reader;
+
+    // Time since the request is sent until the response is received.
+    Histogram &_round_trip_time;
+
+    // Time waiting for a free slot.
+    Histogram &_wait_time;
+
+    Counter &_errors;
 };
 
 }
@@ -0,0 +1,411 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/metrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "sw/assistant/errors.h"
+
+namespace sw::assistant {
+
+namespace {
+
+Error sys_error(const std::string &msg) {
+    return Error(msg + ": " + std::strerror(errno));
+}
+
+std::string escape(const std::string &str) {
+    std::string out;
+    out.reserve(str.size());
+    for (auto ch : str) {
+        switch (ch) {
+        case '"':
+            out += "\\\"";
+            break;
+
+        case '\\':
+            out += "\\\\";
+            break;
+
+        case '\n':
+            out += "\\n";
+            break;
+
+        default:
+            out += ch;
+            break;
+        }
+    }
+
+    return out;
+}
+
+std::string number(double val) {
+    if (std::isnan(val)) {
+        return "NaN";
+    }
+
+    if (std::isinf(val)) {
+        return val > 0 ? "+Inf" : "-Inf";
+    }
+
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.9g", val);
+    return buf;
+}
+
+// JSON has no NaN or Inf.
+std::string json_number(double val) {
+    return std::isfinite(val) ? number(val) : "null";
+}
+
+// {k1="v1",k2="v2"}, or empty if there's no label. `extra` is appended, e.g. le of histogram.
+std::string prometheus_labels(const MetricLabels &labels, const std::string &extra = {}) {
+    if (labels.empty() && extra.empty()) {
+        return {};
+    }
+
+    std::string out = "{";
+    for (const auto &[key, val] : labels) {
+        if (out.size() > 1) {
+            out += ",";
+        }
+        out += key + "=\"" + escape(val) + "\"";
+    }
+    if (!extra.empty()) {
+        if (out.size() > 1) {
+            out += ",";
+        }
+        out += extra;
+    }
+    out += "}";
+
+    return out;
+}
+
+std::string json_labels(const MetricLabels &labels) {
+    std::string out = "{";
+    for (const auto &[key, val] : labels) {
+        if (out.size() > 1) {
+            out += ", ";
+        }
+        out += "\"" + escape(key) + "\": \"" + escape(val) + "\"";
+    }
+    out += "}";
+
+    return out;
+}
+
+void write_all(int fd, const std::string &data, const std::string &target, bool socket = false) {
+    std::size_t offset = 0;
+    while (offset < data.size()) {
+        // MSG_NOSIGNAL: report EPIPE instead of raising SIGPIPE if the peer has gone.
+        auto num = socket ? ::send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL) :
+            ::write(fd, data.data() + offset, data.size() - offset);
+        if (num < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw sys_error("failed to write metrics to " + target);
+        }
+        offset += static_cast<std::size_t>(num);
+    }
+}
+
+}
+
+double Histogram::Snapshot::quantile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+
+    auto rank = q * count;
+    uint64_t seen = 0;
+    for (std::size_t idx = 0; idx < counts.size(); ++idx) {
+        if (counts[idx] == 0 || seen + counts[idx] < rank) {
+            seen += counts[idx];
+            continue;
+        }
+
+        if (idx == bounds.size()) {
+            // +Inf bucket, the best we can tell is the largest bound.
+            return bounds.empty() ? 0 : bounds.back();
+        }
+
+        auto lower = idx == 0 ? 0.0 : bounds[idx - 1];
+        auto upper = bounds[idx];
+        return lower + (upper - lower) * (rank - seen) / counts[idx];
+    }
+
+    return bounds.empty() ? 0 : bounds.back();
+}
+
+Histogram::Histogram(std::vector<double> bounds) : _bounds(std::move(bounds)) {
+    if (!std::is_sorted(_bounds.begin(), _bounds.end())) {
+        throw Error("histogram bounds should be sorted");
+    }
+
+    _counts = std::make_unique<std::atomic<uint64_t>[]>(_bounds.size() + 1);
+}
+
+void Histogram::observe(double val) noexcept {
+    // Bucket i counts values in (bounds[i - 1], bounds[i]].
+    auto idx = std::lower_bound(_bounds.begin(), _bounds.end(), val) - _bounds.begin();
+    _counts[idx].fetch_add(1, std::memory_order_relaxed);
+
+    auto sum = _sum.load(std::memory_order_relaxed);
+    while (!_sum.compare_exchange_weak(sum, sum + val, std::memory_order_relaxed)) {}
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot snapshot;
+    snapshot.bounds = _bounds;
+    snapshot.counts.resize(_bounds.size() + 1);
+    for (std::size_t idx = 0; idx < snapshot.counts.size(); ++idx) {
+        snapshot.counts[idx] = _counts[idx].load(std::memory_order_relaxed);
+        snapshot.count += snapshot.counts[idx];
+    }
+    snapshot.sum = _sum.load(std::memory_order_relaxed);
+
+    return snapshot;
+}
+
+std::vector<double> Histogram::exponential(double start, double factor, std::size_t num) {
+    std::vector<double> bounds;
+    bounds.reserve(num);
+    for (auto bound = start; bounds.size() < num; bound *= factor) {
+        bounds.push_back(bound);
+    }
+
+    return bounds;
+}
+
+std::vector<double> Histogram::latency() {
+    return exponential(1e-5, 2, 23);
+}
+
+MetricsRegistry& MetricsRegistry::instance() {
+    static MetricsRegistry registry;
+
+    return registry;
+}
+
+Counter& MetricsRegistry::counter(const std::string &name, const std::string &help, const MetricLabels &labels) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto &series = _series(name, help, Type::COUNTER, labels);
+    if (!series.counter) {
+        series.counter = std::make_unique<Counter>();
+    }
+
+    return *series.counter;
+}
+
+Gauge& MetricsRegistry::gauge(const std::string &name, const std::string &help, const MetricLabels &labels) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto &series = _series(name, help, Type::GAUGE, labels);
+    if (!series.gauge) {
+        series.gauge = std::make_unique<Gauge>();
+    }
+
+    return *series.gauge;
+}
+
+Histogram& MetricsRegistry::histogram(const std::string &name, const std::string &help,
+        const MetricLabels &labels, const std::vector<double> &bounds) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto &series = _series(name, help, Type::HISTOGRAM, labels);
+    if (!series.histogram) {
+        series.histogram = std::make_unique<Histogram>(bounds);
+    }
+
+    return *series.histogram;
+}
+
+std::string MetricsRegistry::prometheus() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::ostringstream out;
+    for (const auto &[name, family] : _families) {
+        const char *type = family.type == Type::COUNTER ? "counter" :
+            (family.type == Type::GAUGE ? "gauge" : "histogram");
+        out << "# HELP " << name << " " << family.help << "\n";
+        out << "# TYPE " << name << " " << type << "\n";
+
+        for (const auto &[key, series] : family.series) {
+            switch (family.type) {
+            case Type::COUNTER:
+                out << name << prometheus_labels(series.labels) << " " << series.counter->value() << "\n";
+                break;
+
+            case Type::GAUGE:
+                out << name << prometheus_labels(series.labels) << " " << series.gauge->value() << "\n";
+                break;
+
+            case Type::HISTOGRAM: {
+                auto snapshot = series.histogram->snapshot();
+                uint64_t cumulative = 0;
+                for (std::size_t idx = 0; idx < snapshot.counts.size(); ++idx) {
+                    cumulative += snapshot.counts[idx];
+                    auto le = idx < snapshot.bounds.size() ? number(snapshot.bounds[idx]) : "+Inf";
+                    out << name << "_bucket" << prometheus_labels(series.labels, "le=\"" + le + "\"")
+                        << " " << cumulative << "\n";
+                }
+                out << name << "_sum" << prometheus_labels(series.labels) << " " << number(snapshot.sum) << "\n";
+                out << name << "_count" << prometheus_labels(series.labels) << " " << snapshot.count << "\n";
+                break;
+            }
+
+            default:
+                break;
+            }
+        }
+    }
+
+    return out.str();
+}
+
+std::string MetricsRegistry::json() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::ostringstream out;
+    out << "{\"metrics\": [";
+    bool first = true;
+    for (const auto &[name, family] : _families) {
+        for (const auto &[key, series] : family.series) {
+            out << (first ? "\n" : ",\n") << "  {\"name\": \"" << escape(name) << "\", \"labels\": "
+                << json_labels(series.labels);
+            first = false;
+
+            switch (family.type) {
+            case Type::COUNTER:
+                out << ", \"type\": \"counter\", \"value\": " << series.counter->value() << "}";
+                break;
+
+            case Type::GAUGE:
+                out << ", \"type\": \"gauge\", \"value\": " << series.gauge->value() << "}";
+                break;
+
+            case Type::HISTOGRAM: {
+                auto snapshot = series.histogram->snapshot();
+                out << ", \"type\": \"histogram\", \"count\": " << snapshot.count
+                    << ", \"sum\": " << json_number(snapshot.sum)
+                    << ", \"p50\": " << json_number(snapshot.quantile(0.5))
+                    << ", \"p90\": " << json_number(snapshot.quantile(0.9))
+                    << ", \"p99\": " << json_number(snapshot.quantile(0.99))
+                    << ", \"buckets\": [";
+                for (std::size_t idx = 0; idx < snapshot.counts.size(); ++idx) {
+                    auto le = idx < snapshot.bounds.size() ? json_number(snapshot.bounds[idx]) : "null";
+                    out << (idx == 0 ? "" : ", ") << "[" << le << ", " << snapshot.counts[idx] << "]";
+                }
+                out << "]}";
+                break;
+            }
+
+            default:
+                break;
+            }
+        }
+    }
+    out << "\n]}\n";
+
+    return out.str();
+}
+
+void MetricsRegistry::dump(const std::string &path, MetricsFormat fmt) const {
+    auto data = format(fmt);
+
+    // Write to a temporary file, and rename it, so that readers never see a partial snapshot.
+    auto tmp = path + ".tmp";
+    auto fd = ::open(tmp.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw sys_error("failed to open " + tmp);
+    }
+
+    try {
+        write_all(fd, data, tmp);
+    } catch (...) {
+        ::close(fd);
+        ::unlink(tmp.data());
+        throw;
+    }
+
+    if (::close(fd) != 0 || ::rename(tmp.data(), path.data()) != 0) {
+        auto err = sys_error("failed to write metrics to " + path);
+        ::unlink(tmp.data());
+        throw err;
+    }
+}
+
+void MetricsRegistry::send(const std::string &socket_path, MetricsFormat fmt) const {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        throw Error("socket path is too long: " + socket_path);
+    }
+    std::memcpy(addr.sun_path, socket_path.data(), socket_path.size());
+
+    auto data = format(fmt);
+
+    auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw sys_error("failed to create socket");
+    }
+
+    try {
+        if (::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0) {
+            throw sys_error("failed to connect " + socket_path);
+        }
+
+        write_all(fd, data, socket_path, true);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+
+    ::close(fd);
+}
+
+MetricsRegistry::Series& MetricsRegistry::_series(const std::string &name,
+        const std::string &help, Type type, const MetricLabels &labels) {
+    auto iter = _families.find(name);
+    if (iter == _families.end()) {
+        Family family;
+        family.type = type;
+        family.help = help;
+        iter = _families.emplace(name, std::move(family)).first;
+    } else if (iter->second.type != type) {
+        throw Error("metric " + name + " has been registered with another type");
+    }
+
+    auto &series = iter->second.series[prometheus_labels(labels)];
+    series.labels = labels;
+
+    return series;
+}
+
+}
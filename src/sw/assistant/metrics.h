@@ -0,0 +1,200 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_METRICS_H
+#define SEWENEW_ASSISTANT_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace sw::assistant {
+
+// Metrics are updated with relaxed atomics only, i.e. they're cheap enough for hot paths,
+// including SDL's audio thread. Look them up once, and keep the reference, since lookup locks.
+
+class Counter {
+public:
+    void add(uint64_t val = 1) noexcept {
+        _val.fetch_add(val, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const noexcept {
+        return _val.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> _val{0};
+};
+
+class Gauge {
+public:
+    void set(int64_t val) noexcept {
+        _val.store(val, std::memory_order_relaxed);
+    }
+
+    void add(int64_t val) noexcept {
+        _val.fetch_add(val, std::memory_order_relaxed);
+    }
+
+    int64_t value() const noexcept {
+        return _val.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int64_t> _val{0};
+};
+
+// Fixed buckets with atomic counters. Quantiles are estimated from buckets,
+// i.e. their precision depends on bucket bounds.
+class Histogram {
+public:
+    struct Snapshot {
+        // Upper bounds of buckets, the last one, i.e. +Inf, excluded.
+        std::vector<double> bounds;
+
+        // Non-cumulative count of each bucket, including +Inf.
+        std::vector<uint64_t> counts;
+
+        uint64_t count = 0;
+
+        double sum = 0;
+
+        // Linear interpolation within the bucket holding the quantile.
+        double quantile(double q) const;
+    };
+
+    // `bounds` should be sorted in ascending order.
+    explicit Histogram(std::vector<double> bounds);
+
+    void observe(double val) noexcept;
+
+    void observe(std::chrono::steady_clock::duration duration) noexcept {
+        observe(std::chrono::duration<double>(duration).count());
+    }
+
+    Snapshot snapshot() const;
+
+    // Exponential bounds: start, start * factor, ..., `num` bounds in total.
+    static std::vector<double> exponential(double start, double factor, std::size_t num);
+
+    // From 10us to about 40s, for latencies in seconds.
+    static std::vector<double> latency();
+
+private:
+    std::vector<double> _bounds;
+
+    std::unique_ptr<std::atomic<uint64_t>[]> _counts;
+
+    std::atomic<double> _sum{0};
+};
+
+// Observe the elapsed time of a scope.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram &histogram) :
+        _histogram(histogram), _start(std::chrono::steady_clock::now()) {}
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer& operator=(const ScopedTimer &) = delete;
+
+    ~ScopedTimer() {
+        _histogram.observe(std::chrono::steady_clock::now() - _start);
+    }
+
+private:
+    Histogram &_histogram;
+
+    std::chrono::steady_clock::time_point _start;
+};
+
+enum class MetricsFormat {
+    PROMETHEUS = 0,
+    JSON
+};
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+// Registered metrics live as long as the registry. Getting a metric with the same name and
+// labels returns the same object, and getting a name with a different type throws Error.
+// It's thread-safe.
+class MetricsRegistry {
+public:
+    // Registry used by the library's components.
+    static MetricsRegistry& instance();
+
+    Counter& counter(const std::string &name, const std::string &help, const MetricLabels &labels = {});
+
+    Gauge& gauge(const std::string &name, const std::string &help, const MetricLabels &labels = {});
+
+    Histogram& histogram(const std::string &name, const std::string &help,
+            const MetricLabels &labels = {}, const std::vector<double> &bounds = Histogram::latency());
+
+    // Prometheus text exposition format.
+    std::string prometheus() const;
+
+    // {"metrics": [{"name": ..., "type": ..., "labels": {...}, ...}, ...]}
+    std::string json() const;
+
+    std::string format(MetricsFormat fmt) const {
+        return fmt == MetricsFormat::PROMETHEUS ? prometheus() : json();
+    }
+
+    // Write a snapshot to file, which is replaced atomically, e.g. for node_exporter's textfile collector.
+    void dump(const std::string &path, MetricsFormat fmt = MetricsFormat::PROMETHEUS) const;
+
+    // Send a snapshot to a Unix domain stream socket, e.g. of a local collector.
+    void send(const std::string &socket_path, MetricsFormat fmt = MetricsFormat::JSON) const;
+
+private:
+    enum class Type {
+        COUNTER = 0,
+        GAUGE,
+        HISTOGRAM
+    };
+
+    struct Series {
+        MetricLabels labels;
+
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+
+    struct Family {
+        Type type;
+        std::string help;
+
+        // Keyed by rendered labels.
+        std::map<std::string, Series> series;
+    };
+
+    Series& _series(const std::string &name, const std::string &help, Type type, const MetricLabels &labels);
+
+    mutable std::mutex _mutex;
+
+    std::map<std::string, Family> _families;
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_METRICS_H
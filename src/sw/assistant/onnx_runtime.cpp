@@ -0,0 +1,178 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/onnx_runtime.h"
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+#include <unistd.h>
+#include "sw/assistant/errors.h"
+
+namespace {
+
+using namespace sw::assistant;
+
+std::mutex runtime_mutex;
+
+OnnxRuntimeOptions runtime_options;
+
+bool runtime_created = false;
+
+std::string session_key(const std::string &model_path, const OnnxSessionOptions &opts) {
+    auto key = model_path + "|" + std::to_string(static_cast<int>(opts.optimization)) +
+        "|" + opts.optimized_model_path;
+    for (const auto &provider : opts.execution_providers) {
+        key += "|" + provider;
+    }
+
+    return key;
+}
+
+// Whether the optimized model exists, and is not older than the model.
+bool is_fresh(const std::string &optimized_path, const std::string &model_path) {
+    std::error_code ec;
+    auto optimized_time = std::filesystem::last_write_time(optimized_path, ec);
+    if (ec) {
+        return false;
+    }
+
+    auto model_time = std::filesystem::last_write_time(model_path, ec);
+
+    return !ec && optimized_time >= model_time;
+}
+
+void append_dnnl(Ort::SessionOptions &session_options) {
+    const auto &api = Ort::GetApi();
+
+    OrtDnnlProviderOptions *dnnl_options = nullptr;
+    Ort::ThrowOnError(api.CreateDnnlProviderOptions(&dnnl_options));
+
+    auto *status = api.SessionOptionsAppendExecutionProvider_Dnnl(session_options, dnnl_options);
+    api.ReleaseDnnlProviderOptions(dnnl_options);
+
+    Ort::ThrowOnError(status);
+}
+
+void append_providers(Ort::SessionOptions &session_options, const std::vector<std::string> &providers) {
+    for (const auto &provider : providers) {
+        try {
+            if (provider == "DNNL") {
+                // oneDNN is not supported by the generic API.
+                append_dnnl(session_options);
+            } else {
+                session_options.AppendExecutionProvider(provider);
+            }
+        } catch (const Ort::Exception &e) {
+            throw Error("failed to enable ONNX Runtime execution provider " + provider + ": " + e.what());
+        }
+    }
+}
+
+}
+
+namespace sw::assistant {
+
+void OnnxRuntime::configure(const OnnxRuntimeOptions &opts) {
+    if (opts.intra_threads <= 0 || opts.inter_threads <= 0) {
+        throw Error("invalid ONNX Runtime thread number");
+    }
+
+    std::lock_guard<std::mutex> lock(runtime_mutex);
+    if (runtime_created) {
+        throw Error("ONNX Runtime has already been initialized");
+    }
+
+    runtime_options = opts;
+}
+
+OnnxRuntime& OnnxRuntime::instance() {
+    static OnnxRuntime &runtime = []() -> OnnxRuntime& {
+        std::lock_guard<std::mutex> lock(runtime_mutex);
+        runtime_created = true;
+
+        // Never destroyed, since sessions, e.g. of static objects, might outlive it.
+        return *new OnnxRuntime(runtime_options);
+    }();
+
+    return runtime;
+}
+
+OnnxRuntime::OnnxRuntime(const OnnxRuntimeOptions &opts) : _env(_make_env(opts)) {}
+
+Ort::Env OnnxRuntime::_make_env(const OnnxRuntimeOptions &opts) {
+    Ort::ThreadingOptions threading;
+    threading.SetGlobalIntraOpNumThreads(opts.intra_threads);
+    threading.SetGlobalInterOpNumThreads(opts.inter_threads);
+
+    return Ort::Env(threading, opts.log_level, "assistant");
+}
+
+std::shared_ptr<Ort::Session> OnnxRuntime::session(const std::string &model_path,
+        const OnnxSessionOptions &opts) {
+    auto key = session_key(model_path, opts);
+
+    // Sessions are created under the lock, so that a model is never loaded twice.
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto &cached = _sessions[key];
+    auto session = cached.lock();
+    if (session) {
+        return session;
+    }
+
+    Ort::SessionOptions session_options;
+    session_options.DisablePerSessionThreads();
+
+    session = create_session(model_path, opts, session_options);
+    cached = session;
+
+    return session;
+}
+
+std::unique_ptr<Ort::Session> OnnxRuntime::create_session(const std::string &model_path,
+        const OnnxSessionOptions &opts, Ort::SessionOptions &session_options) {
+    auto cache = !opts.optimized_model_path.empty() && opts.execution_providers.empty();
+    if (cache && is_fresh(opts.optimized_model_path, model_path)) {
+        try {
+            // It's been optimized, and optimizing it again only costs startup time.
+            session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
+            return std::make_unique<Ort::Session>(_env, opts.optimized_model_path.data(), session_options);
+        } catch (const Ort::Exception &) {
+            // Broken cache, e.g. written by another version of ORT. Optimize and save it again.
+        }
+    }
+
+    session_options.SetGraphOptimizationLevel(opts.optimization);
+    append_providers(session_options, opts.execution_providers);
+
+    // Saved to a temporary file first, so that other processes never load a partial model.
+    std::string tmp_path;
+    if (cache) {
+        tmp_path = opts.optimized_model_path + ".tmp." + std::to_string(::getpid());
+        session_options.SetOptimizedModelFilePath(tmp_path.data());
+    }
+
+    auto session = std::make_unique<Ort::Session>(_env, model_path.data(), session_options);
+
+    if (cache && std::rename(tmp_path.data(), opts.optimized_model_path.data()) != 0) {
+        // Cache is best effort, and the session is good anyway.
+        std::remove(tmp_path.data());
+    }
+
+    return session;
+}
+
+}
@@ -0,0 +1,95 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_ONNX_RUNTIME_H
+#define SEWENEW_ASSISTANT_ONNX_RUNTIME_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "onnxruntime_cxx_api.h"
+
+namespace sw::assistant {
+
+struct OnnxRuntimeOptions {
+    // Size of global thread pools shared by all sessions. Since the caller's thread also runs ops,
+    // 1 means no extra thread, i.e. each Run is single-threaded on the caller's thread.
+    int intra_threads = 1;
+    int inter_threads = 1;
+
+    OrtLoggingLevel log_level = ORT_LOGGING_LEVEL_WARNING;
+};
+
+struct OnnxSessionOptions {
+    GraphOptimizationLevel optimization = GraphOptimizationLevel::ORT_ENABLE_ALL;
+
+    // If it's not empty, the optimized model is saved to this path when the model is loaded,
+    // and later loads read it directly without optimizing again, as long as it's newer than the model.
+    // It's ignored if `execution_providers` is not empty, since ORT can't save models partitioned to them.
+    std::string optimized_model_path;
+
+    // CPU execution providers, in order of preference, e.g. "XNNPACK" or "DNNL".
+    // Nodes which they don't support run on the default CPU provider.
+    std::vector<std::string> execution_providers;
+};
+
+// Process-wide ONNX Runtime environment with global thread pools, and a cache of sessions.
+// A session is read-only after creation, and Session::Run is thread-safe, so it's shared by
+// all users of the same model, i.e. the model graph and weights are loaded only once.
+// It's thread-safe.
+class OnnxRuntime {
+public:
+    // Set options of the environment. It should be called before the first call to `instance`.
+    static void configure(const OnnxRuntimeOptions &opts);
+
+    static OnnxRuntime& instance();
+
+    OnnxRuntime(const OnnxRuntime &) = delete;
+    OnnxRuntime& operator=(const OnnxRuntime &) = delete;
+
+    OnnxRuntime(OnnxRuntime &&) = delete;
+    OnnxRuntime& operator=(OnnxRuntime &&) = delete;
+
+    Ort::Env& env() {
+        return _env;
+    }
+
+    // Session running on global thread pools, which is shared by callers with the same model
+    // and options. It's released when the last caller releases it.
+    std::shared_ptr<Ort::Session> session(const std::string &model_path, const OnnxSessionOptions &opts = {});
+
+    // Create a session which is not cached. Threading of `session_options` is kept as is,
+    // and other settings are taken from `opts`.
+    std::unique_ptr<Ort::Session> create_session(const std::string &model_path,
+            const OnnxSessionOptions &opts, Ort::SessionOptions &session_options);
+
+private:
+    explicit OnnxRuntime(const OnnxRuntimeOptions &opts);
+
+    static Ort::Env _make_env(const OnnxRuntimeOptions &opts);
+
+    Ort::Env _env;
+
+    std::mutex _mutex;
+
+    std::unordered_map<std::string, std::weak_ptr<Ort::Session>> _sessions;
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_ONNX_RUNTIME_H
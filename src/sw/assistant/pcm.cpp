@@ -0,0 +1,653 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/pcm.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "sw/assistant/errors.h"
+#include "sw/assistant/simd.h"
+
+namespace sw::assistant::pcm {
+
+namespace {
+
+constexpr float S16_SCALE = 1.0f / 32768.0f;
+constexpr float S32_SCALE = 1.0f / 2147483648.0f;
+constexpr float U8_SCALE = 1.0f / 128.0f;
+
+// Largest float below 2^31, so that conversion to int32 never overflows.
+constexpr float S32_MAX = 2147483520.0f;
+
+// Each kernel converts a prefix of the input, and returns the number of samples (or frames) done.
+template <typename In, typename Out>
+using Kernel = std::size_t (*)(const In *in, std::size_t samples, Out *out);
+
+namespace scalar {
+
+std::size_t s16_to_f32(const int16_t *in, std::size_t samples, float *out) {
+    for (std::size_t idx = 0; idx < samples; ++idx) {
+        out[idx] = in[idx] * S16_SCALE;
+    }
+    return samples;
+}
+
+std::size_t s32_to_f32(const int32_t *in, std::size_t samples, float *out) {
+    for (std::size_t idx = 0; idx < samples; ++idx) {
+        out[idx] = static_cast<float>(in[idx]) * S32_SCALE;
+    }
+    return samples;
+}
+
+std::size_t u8_to_f32(const uint8_t *in, std::size_t samples, float *out) {
+    for (std::size_t idx = 0; idx < samples; ++idx) {
+        out[idx] = (static_cast<int>(in[idx]) - 128) * U8_SCALE;
+    }
+    return samples;
+}
+
+std::size_t f32_to_s16(const float *in, std::size_t samples, int16_t *out) {
+    for (std::size_t idx = 0; idx < samples; ++idx) {
+        auto val = std::clamp(in[idx], -1.0f, 1.0f);
+        out[idx] = static_cast<int16_t>(std::lrint(val * 32767.0f));
+    }
+    return samples;
+}
+
+std::size_t f32_to_s32(const float *in, std::size_t samples, int32_t *out) {
+    for (std::size_t idx = 0; idx < samples; ++idx) {
+        auto val = std::clamp(in[idx] * 2147483648.0f, -2147483648.0f, S32_MAX);
+        out[idx] = static_cast<int32_t>(std::lrint(val));
+    }
+    return samples;
+}
+
+std::size_t f32_to_u8(const float *in, std::size_t samples, uint8_t *out) {
+    for (std::size_t idx = 0; idx < samples; ++idx) {
+        auto val = std::clamp(in[idx], -1.0f, 1.0f);
+        out[idx] = static_cast<uint8_t>(std::lrint(val * 127.0f) + 128);
+    }
+    return samples;
+}
+
+std::size_t downmix_stereo(const float *in, std::size_t frames, float *out) {
+    for (std::size_t idx = 0; idx < frames; ++idx) {
+        out[idx] = (in[2 * idx] + in[2 * idx + 1]) * 0.5f;
+    }
+    return frames;
+}
+
+std::size_t upmix_stereo(const float *in, std::size_t frames, float *out) {
+    for (std::size_t idx = 0; idx < frames; ++idx) {
+        out[2 * idx] = out[2 * idx + 1] = in[idx];
+    }
+    return frames;
+}
+
+}
+
+#if defined(SW_ASSISTANT_AVX2)
+
+namespace avx2 {
+
+SW_ASSISTANT_TARGET_AVX2
+std::size_t s16_to_f32(const int16_t *in, std::size_t samples, float *out) {
+    const auto scale = _mm256_set1_ps(S16_SCALE);
+    std::size_t idx = 0;
+    for (; idx + 8 <= samples; idx += 8) {
+        auto x = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + idx)));
+        _mm256_storeu_ps(out + idx, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+    return idx;
+}
+
+SW_ASSISTANT_TARGET_AVX2
+std::size_t s32_to_f32(const int32_t *in, std::size_t samples, float *out) {
+    const auto scale = _mm256_set1_ps(S32_SCALE);
+    std::size_t idx = 0;
+    for (; idx + 8 <= samples; idx += 8) {
+        auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + idx));
+        _mm256_storeu_ps(out + idx, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+    return idx;
+}
+
+SW_ASSISTANT_TARGET_AVX2
+std::size_t u8_to_f32(const uint8_t *in, std::size_t samples, float *out) {
+    const auto scale = _mm256_set1_ps(U8_SCALE);
+    const auto bias = _mm256_set1_epi32(128);
+    std::size_t idx = 0;
+    for (; idx + 8 <= samples; idx += 8) {
+        auto x = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + idx)));
+        x = _mm256_sub_epi32(x, bias);
+        _mm256_storeu_ps(out + idx, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+    return idx;
+}
+
+SW_ASSISTANT_TARGET_AVX2
+std::size_t f32_to_s16(const float *in, std::size_t samples, int16_t *out) {
+    const auto lo = _mm256_set1_ps(-1.0f);
+    const auto hi = _mm256_set1_ps(1.0f);
+    const auto scale = _mm256_set1_ps(32767.0f);
+    std::size_t idx = 0;
+    for (; idx + 16 <= samples; idx += 16) {
+        auto a = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + idx), lo), hi);
+        auto b = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + idx + 8), lo), hi);
+        auto x = _mm256_packs_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(a, scale)),
+                _mm256_cvtps_epi32(_mm256_mul_ps(b, scale)));
+        // packs works within 128-bit lanes: a0-3 b0-3 a4-7 b4-7 -> a0-7 b0-7
+        x = _mm256_permute4x64_epi64(x, 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + idx), x);
+    }
+    return idx;
+}
+
+SW_ASSISTANT_TARGET_AVX2
+std::size_t f32_to_s32(const float *in, std::size_t samples, int32_t *out) {
+    const auto lo = _mm256_set1_ps(-2147483648.0f);
+    const auto hi = _mm256_set1_ps(S32_MAX);
+    const auto scale = _mm256_set1_ps(2147483648.0f);
+    std::size_t idx = 0;
+    for (; idx + 8 <= samples; idx += 8) {
+        auto x = _mm256_mul_ps(_mm256_loadu_ps(in + idx), scale);
+        x = _mm256_min_ps(_mm256_max_ps(x, lo), hi);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + idx), _mm256_cvtps_epi32(x));
+    }
+    return idx;
+}
+
+SW_ASSISTANT_TARGET_AVX2
+std::size_t downmix_stereo(const float *in, std::size_t frames, float *out) {
+    const auto half = _mm256_set1_ps(0.5f);
+    std::size_t idx = 0;
+    for (; idx + 8 <= frames; idx += 8) {
+        auto a = _mm256_loadu_ps(in + 2 * idx);
+        auto b = _mm256_loadu_ps(in + 2 * idx + 8);
+        // left: a0 a2 b0 b2 a4 a6 b4 b6, right: a1 a3 b1 b3 a5 a7 b5 b7
+        auto left = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        auto right = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        auto mono = _mm256_mul_ps(_mm256_add_ps(left, right), half);
+        // Restore frame order across 128-bit lanes.
+        mono = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(mono), 0xD8));
+        _mm256_storeu_ps(out + idx, mono);
+    }
+    return idx;
+}
+
+}
+
+#endif
+
+#if defined(SW_ASSISTANT_SSE2)
+
+namespace vec {
+
+std::size_t s16_to_f32(const int16_t *in, std::size_t samples, float *out) {
+    const auto scale = _mm_set1_ps(S16_SCALE);
+    std::size_t idx = 0;
+    for (; idx + 8 <= samples; idx += 8) {
+        auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + idx));
+        // Sign extend by moving each int16 to the high half, and shifting back.
+        auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(out + idx, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + idx + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    return idx;
+}
+
+std::size_t s32_to_f32(const int32_t *in, std::size_t samples, float *out) {
+    const auto scale = _mm_set1_ps(S32_SCALE);
+    std::size_t idx = 0;
+    for (; idx + 4 <= samples; idx += 4) {
+        auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + idx));
+        _mm_storeu_ps(out + idx, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+    }
+    return idx;
+}
+
+std::size_t u8_to_f32(const uint8_t *in, std::size_t samples, float *out) {
+    const auto scale = _mm_set1_ps(U8_SCALE);
+    const auto bias = _mm_set1_epi16(128);
+    const auto zero = _mm_setzero_si128();
+    std::size_t idx = 0;
+    for (; idx + 8 <= samples; idx += 8) {
+        auto x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + idx));
+        x = _mm_sub_epi16(_mm_unpacklo_epi8(x, zero), bias);
+        auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(out + idx, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + idx + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    return idx;
+}
+
+std::size_t f32_to_s16(const float *in, std::size_t samples, int16_t *out) {
+    const auto lo = _mm_set1_ps(-1.0f);
+    const auto hi = _mm_set1_ps(1.0f);
+    const auto scale = _mm_set1_ps(32767.0f);
+    std::size_t idx = 0;
+    for (; idx + 8 <= samples; idx += 8) {
+        auto a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + idx), lo), hi);
+        auto b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + idx + 4), lo), hi);
+        auto x = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(a, scale)),
+                _mm_cvtps_epi32(_mm_mul_ps(b, scale)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + idx), x);
+    }
+    return idx;
+}
+
+std::size_t f32_to_s32(const float *in, std::size_t samples, int32_t *out) {
+    const auto lo = _mm_set1_ps(-2147483648.0f);
+    const auto hi = _mm_set1_ps(S32_MAX);
+    const auto scale = _mm_set1_ps(2147483648.0f);
+    std::size_t idx = 0;
+    for (; idx + 4 <= samples; idx += 4) {
+        auto x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + idx), scale), lo), hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + idx), _mm_cvtps_epi32(x));
+    }
+    return idx;
+}
+
+std::size_t f32_to_u8(const float *in, std::size_t samples, uint8_t *out) {
+    const auto lo = _mm_set1_ps(-1.0f);
+    const auto hi = _mm_set1_ps(1.0f);
+    const auto scale = _mm_set1_ps(127.0f);
+    const auto bias = _mm_set1_epi32(128);
+    std::size_t idx = 0;
+    for (; idx + 16 <= samples; idx += 16) {
+        __m128i x[4];
+        for (auto i = 0; i < 4; ++i) {
+            auto val = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + idx + 4 * i), lo), hi);
+            x[i] = _mm_add_epi32(_mm_cvtps_epi32(_mm_mul_ps(val, scale)), bias);
+        }
+        auto packed = _mm_packus_epi16(_mm_packs_epi32(x[0], x[1]), _mm_packs_epi32(x[2], x[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + idx), packed);
+    }
+    return idx;
+}
+
+std::size_t downmix_stereo(const float *in, std::size_t frames, float *out) {
+    const auto half = _mm_set1_ps(0.5f);
+    std::size_t idx = 0;
+    for (; idx + 4 <= frames; idx += 4) {
+        auto a = _mm_loadu_ps(in + 2 * idx);
+        auto b = _mm_loadu_ps(in + 2 * idx + 4);
+        auto left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        auto right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(out + idx, _mm_mul_ps(_mm_add_ps(left, right), half));
+    }
+    return idx;
+}
+
+std::size_t upmix_stereo(const float *in, std::size_t frames, float *out) {
+    std::size_t idx = 0;
+    for (; idx + 4 <= frames; idx += 4) {
+        auto x = _mm_loadu_ps(in + idx);
+        _mm_storeu_ps(out + 2 * idx, _mm_unpacklo_ps(x, x));
+        _mm_storeu_ps(out + 2 * idx + 4, _mm_unpackhi_ps(x, x));
+    }
+    return idx;
+}
+
+}
+
+#elif defined(SW_ASSISTANT_NEON)
+
+namespace vec {
+
+std::size_t s16_to_f32(const int16_t *in, std::size_t samples, float *out) {
+    std::size_t idx = 0;
+    for (; idx + 8 <= samples; idx += 8) {
+        auto x = vld1q_s16(in + idx);
+        vst1q_f32(out + idx, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), S16_SCALE));
+        vst1q_f32(out + idx + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_high_s16(x)), S16_SCALE));
+    }
+    return idx;
+}
+
+std::size_t s32_to_f32(const int32_t *in, std::size_t samples, float *out) {
+    std::size_t idx = 0;
+    for (; idx + 4 <= samples; idx += 4) {
+        vst1q_f32(out + idx, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(in + idx)), S32_SCALE));
+    }
+    return idx;
+}
+
+std::size_t u8_to_f32(const uint8_t *in, std::size_t samples, float *out) {
+    std::size_t idx = 0;
+    for (; idx + 8 <= samples; idx += 8) {
+        auto x = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(in + idx))), vdupq_n_s16(128));
+        vst1q_f32(out + idx, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), U8_SCALE));
+        vst1q_f32(out + idx + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_high_s16(x)), U8_SCALE));
+    }
+    return idx;
+}
+
+std::size_t f32_to_s16(const float *in, std::size_t samples, int16_t *out) {
+    const auto lo = vdupq_n_f32(-1.0f);
+    const auto hi = vdupq_n_f32(1.0f);
+    std::size_t idx = 0;
+    for (; idx + 8 <= samples; idx += 8) {
+        auto a = vminq_f32(vmaxq_f32(vld1q_f32(in + idx), lo), hi);
+        auto b = vminq_f32(vmaxq_f32(vld1q_f32(in + idx + 4), lo), hi);
+        auto x = vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(vmulq_n_f32(a, 32767.0f))),
+                vqmovn_s32(vcvtnq_s32_f32(vmulq_n_f32(b, 32767.0f))));
+        vst1q_s16(out + idx, x);
+    }
+    return idx;
+}
+
+std::size_t f32_to_s32(const float *in, std::size_t samples, int32_t *out) {
+    const auto lo = vdupq_n_f32(-2147483648.0f);
+    const auto hi = vdupq_n_f32(S32_MAX);
+    std::size_t idx = 0;
+    for (; idx + 4 <= samples; idx += 4) {
+        auto x = vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(in + idx), 2147483648.0f), lo), hi);
+        vst1q_s32(out + idx, vcvtnq_s32_f32(x));
+    }
+    return idx;
+}
+
+std::size_t f32_to_u8(const float *in, std::size_t samples, uint8_t *out) {
+    const auto lo = vdupq_n_f32(-1.0f);
+    const auto hi = vdupq_n_f32(1.0f);
+    const auto bias = vdupq_n_f32(128.0f);
+    std::size_t idx = 0;
+    for (; idx + 8 <= samples; idx += 8) {
+        auto a = vminq_f32(vmaxq_f32(vld1q_f32(in + idx), lo), hi);
+        auto b = vminq_f32(vmaxq_f32(vld1q_f32(in + idx + 4), lo), hi);
+        auto x = vcombine_u16(vqmovn_u32(vcvtnq_u32_f32(vmlaq_n_f32(bias, a, 127.0f))),
+                vqmovn_u32(vcvtnq_u32_f32(vmlaq_n_f32(bias, b, 127.0f))));
+        vst1_u8(out + idx, vqmovn_u16(x));
+    }
+    return idx;
+}
+
+std::size_t downmix_stereo(const float *in, std::size_t frames, float *out) {
+    std::size_t idx = 0;
+    for (; idx + 4 <= frames; idx += 4) {
+        auto x = vld2q_f32(in + 2 * idx);
+        vst1q_f32(out + idx, vmulq_n_f32(vaddq_f32(x.val[0], x.val[1]), 0.5f));
+    }
+    return idx;
+}
+
+std::size_t upmix_stereo(const float *in, std::size_t frames, float *out) {
+    std::size_t idx = 0;
+    for (; idx + 4 <= frames; idx += 4) {
+        auto x = vld1q_f32(in + idx);
+        vst2q_f32(out + 2 * idx, float32x4x2_t{{x, x}});
+    }
+    return idx;
+}
+
+}
+
+#endif
+
+#if defined(SW_ASSISTANT_AVX2)
+#define SW_ASSISTANT_AVX2_KERNEL(name) avx2::name
+#else
+#define SW_ASSISTANT_AVX2_KERNEL(name) nullptr
+#endif
+
+#if defined(SW_ASSISTANT_SSE2) || defined(SW_ASSISTANT_NEON)
+#define SW_ASSISTANT_VEC_KERNEL(name) vec::name
+#else
+#define SW_ASSISTANT_VEC_KERNEL(name) nullptr
+#endif
+
+// Run the widest kernel available on the bulk of input, and narrower ones on what's left.
+// `stride` is the number of input elements per output element.
+template <typename In, typename Out>
+void run(const In *in, std::size_t num, Out *out,
+        Kernel<In, Out> avx2_kernel, Kernel<In, Out> vec_kernel, Kernel<In, Out> scalar_kernel,
+        std::size_t in_stride = 1, std::size_t out_stride = 1) {
+    std::size_t idx = 0;
+    if (avx2_kernel != nullptr && simd::has_avx2()) {
+        idx += avx2_kernel(in, num, out);
+    }
+
+    if (vec_kernel != nullptr) {
+        idx += vec_kernel(in + idx * in_stride, num - idx, out + idx * out_stride);
+    }
+
+    scalar_kernel(in + idx * in_stride, num - idx, out + idx * out_stride);
+}
+
+template <typename In>
+const In* as(const void *data) {
+    return static_cast<const In *>(data);
+}
+
+template <typename Out>
+Out* as(void *data) {
+    return static_cast<Out *>(data);
+}
+
+void to_f32(const void *in, std::size_t samples, SDL_AudioFormat format, float *out) {
+    switch (format) {
+    case AUDIO_U8:
+        u8_to_f32(as<uint8_t>(in), samples, out);
+        break;
+
+    case AUDIO_S16SYS:
+        s16_to_f32(as<int16_t>(in), samples, out);
+        break;
+
+    case AUDIO_S32SYS:
+        s32_to_f32(as<int32_t>(in), samples, out);
+        break;
+
+    case AUDIO_F32SYS:
+        std::memmove(out, in, samples * sizeof(float));
+        break;
+
+    default:
+        throw Error("unsupported audio format");
+    }
+}
+
+void from_f32(const float *in, std::size_t samples, SDL_AudioFormat format, void *out) {
+    switch (format) {
+    case AUDIO_U8:
+        f32_to_u8(in, samples, as<uint8_t>(out));
+        break;
+
+    case AUDIO_S16SYS:
+        f32_to_s16(in, samples, as<int16_t>(out));
+        break;
+
+    case AUDIO_S32SYS:
+        f32_to_s32(in, samples, as<int32_t>(out));
+        break;
+
+    case AUDIO_F32SYS:
+        std::memmove(out, in, samples * sizeof(float));
+        break;
+
+    default:
+        throw Error("unsupported audio format");
+    }
+}
+
+// Multi-channel audio is converted block by block through a small stack buffer.
+constexpr std::size_t BLOCK_SAMPLES = 1024;
+
+}
+
+std::size_t sample_size(SDL_AudioFormat format) {
+    switch (format) {
+    case AUDIO_U8:
+        return 1;
+
+    case AUDIO_S16SYS:
+        return 2;
+
+    case AUDIO_S32SYS:
+    case AUDIO_F32SYS:
+        return 4;
+
+    default:
+        throw Error("unsupported audio format");
+    }
+}
+
+void s16_to_f32(const int16_t *in, std::size_t samples, float *out) {
+    run(in, samples, out, SW_ASSISTANT_AVX2_KERNEL(s16_to_f32),
+            SW_ASSISTANT_VEC_KERNEL(s16_to_f32), scalar::s16_to_f32);
+}
+
+void s32_to_f32(const int32_t *in, std::size_t samples, float *out) {
+    run(in, samples, out, SW_ASSISTANT_AVX2_KERNEL(s32_to_f32),
+            SW_ASSISTANT_VEC_KERNEL(s32_to_f32), scalar::s32_to_f32);
+}
+
+void u8_to_f32(const uint8_t *in, std::size_t samples, float *out) {
+    run(in, samples, out, SW_ASSISTANT_AVX2_KERNEL(u8_to_f32),
+            SW_ASSISTANT_VEC_KERNEL(u8_to_f32), scalar::u8_to_f32);
+}
+
+void f32_to_s16(const float *in, std::size_t samples, int16_t *out) {
+    run(in, samples, out, SW_ASSISTANT_AVX2_KERNEL(f32_to_s16),
+            SW_ASSISTANT_VEC_KERNEL(f32_to_s16), scalar::f32_to_s16);
+}
+
+void f32_to_s32(const float *in, std::size_t samples, int32_t *out) {
+    run(in, samples, out, SW_ASSISTANT_AVX2_KERNEL(f32_to_s32),
+            SW_ASSISTANT_VEC_KERNEL(f32_to_s32), scalar::f32_to_s32);
+}
+
+void f32_to_u8(const float *in, std::size_t samples, uint8_t *out) {
+    run<float, uint8_t>(in, samples, out, nullptr,
+            SW_ASSISTANT_VEC_KERNEL(f32_to_u8), scalar::f32_to_u8);
+}
+
+void downmix(const float *in, std::size_t frames, uint16_t channels, float *out) {
+    switch (channels) {
+    case 0:
+        throw Error("invalid channel number");
+
+    case 1:
+        if (in != out) {
+            std::memmove(out, in, frames * sizeof(float));
+        }
+        break;
+
+    case 2:
+        run(in, frames, out, SW_ASSISTANT_AVX2_KERNEL(downmix_stereo),
+                SW_ASSISTANT_VEC_KERNEL(downmix_stereo), scalar::downmix_stereo, 2, 1);
+        break;
+
+    default:
+        for (std::size_t frame = 0; frame < frames; ++frame) {
+            const auto *samples = in + frame * channels;
+            auto sum = 0.0f;
+            for (auto ch = 0U; ch < channels; ++ch) {
+                sum += samples[ch];
+            }
+            out[frame] = sum / channels;
+        }
+        break;
+    }
+}
+
+void upmix(const float *in, std::size_t frames, uint16_t channels, float *out) {
+    switch (channels) {
+    case 0:
+        throw Error("invalid channel number");
+
+    case 1:
+        if (in != out) {
+            std::memmove(out, in, frames * sizeof(float));
+        }
+        break;
+
+    case 2:
+        run<float, float>(in, frames, out, nullptr,
+                SW_ASSISTANT_VEC_KERNEL(upmix_stereo), scalar::upmix_stereo, 1, 2);
+        break;
+
+    default:
+        for (std::size_t frame = 0; frame < frames; ++frame) {
+            std::fill_n(out + frame * channels, channels, in[frame]);
+        }
+        break;
+    }
+}
+
+std::size_t to_mono_f32(const void *in, std::size_t bytes,
+        SDL_AudioFormat format, uint16_t channels, float *out) {
+    if (channels == 0) {
+        throw Error("invalid channel number");
+    }
+
+    auto frame_size = sample_size(format) * channels;
+    auto frames = bytes / frame_size;
+
+    if (channels == 1) {
+        to_f32(in, frames, format, out);
+        return frames;
+    }
+
+    float block[BLOCK_SAMPLES];
+    auto block_frames = BLOCK_SAMPLES / channels;
+    if (block_frames == 0) {
+        throw Error("too many channels");
+    }
+
+    const auto *src = static_cast<const uint8_t *>(in);
+    for (std::size_t frame = 0; frame < frames; frame += block_frames) {
+        auto num = std::min(block_frames, frames - frame);
+        to_f32(src + frame * frame_size, num * channels, format, block);
+        downmix(block, num, channels, out + frame);
+    }
+
+    return frames;
+}
+
+std::size_t from_mono_f32(const float *in, std::size_t frames,
+        SDL_AudioFormat format, uint16_t channels, void *out) {
+    if (channels == 0) {
+        throw Error("invalid channel number");
+    }
+
+    auto frame_size = sample_size(format) * channels;
+
+    if (channels == 1) {
+        from_f32(in, frames, format, out);
+        return frames * frame_size;
+    }
+
+    float block[BLOCK_SAMPLES];
+    auto block_frames = BLOCK_SAMPLES / channels;
+    if (block_frames == 0) {
+        throw Error("too many channels");
+    }
+
+    auto *dst = static_cast<uint8_t *>(out);
+    for (std::size_t frame = 0; frame < frames; frame += block_frames) {
+        auto num = std::min(block_frames, frames - frame);
+        upmix(in + frame, num, channels, block);
+        from_f32(block, num * channels, format, dst + frame * frame_size);
+    }
+
+    return frames * frame_size;
+}
+
+}
@@ -0,0 +1,85 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_PCM_H
+#define SEWENEW_ASSISTANT_PCM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <SDL2/SDL.h>
+
+namespace sw::assistant {
+
+// Sample format conversion between PCM formats and float32 in [-1.0, 1.0].
+// Kernels are vectorized with AVX2/SSE2/NEON, fall back to scalar code otherwise,
+// and write into caller-provided buffers, i.e. they never allocate.
+// Supported formats are AUDIO_U8, AUDIO_S16SYS, AUDIO_S32SYS and AUDIO_F32SYS.
+namespace pcm {
+
+// Bytes per sample of `format`. Throws Error if the format is not supported.
+std::size_t sample_size(SDL_AudioFormat format);
+
+// Format of samples of type T, i.e. uint8_t, int16_t, int32_t or float.
+template <typename T>
+constexpr SDL_AudioFormat format_of() {
+    if constexpr (std::is_same_v<T, uint8_t>) {
+        return AUDIO_U8;
+    } else if constexpr (std::is_same_v<T, int16_t>) {
+        return AUDIO_S16SYS;
+    } else if constexpr (std::is_same_v<T, int32_t>) {
+        return AUDIO_S32SYS;
+    } else {
+        static_assert(std::is_same_v<T, float>, "unsupported sample type");
+        return AUDIO_F32SYS;
+    }
+}
+
+void s16_to_f32(const int16_t *in, std::size_t samples, float *out);
+
+void s32_to_f32(const int32_t *in, std::size_t samples, float *out);
+
+void u8_to_f32(const uint8_t *in, std::size_t samples, float *out);
+
+// Samples out of [-1.0, 1.0] are clipped.
+void f32_to_s16(const float *in, std::size_t samples, int16_t *out);
+
+void f32_to_s32(const float *in, std::size_t samples, int32_t *out);
+
+void f32_to_u8(const float *in, std::size_t samples, uint8_t *out);
+
+// Average interleaved channels into mono. `in` and `out` might be the same buffer.
+void downmix(const float *in, std::size_t frames, uint16_t channels, float *out);
+
+// Copy mono into each of the interleaved channels.
+void upmix(const float *in, std::size_t frames, uint16_t channels, float *out);
+
+// Convert interleaved samples of `format` to mono float32. `out` should hold at least
+// `bytes / (sample_size(format) * channels)` floats. Trailing partial frame is ignored.
+// Returns the number of frames converted.
+std::size_t to_mono_f32(const void *in, std::size_t bytes,
+        SDL_AudioFormat format, uint16_t channels, float *out);
+
+// Convert mono float32 to interleaved samples of `format`. `out` should hold at least
+// `frames * channels * sample_size(format)` bytes. Returns the number of bytes written.
+std::size_t from_mono_f32(const float *in, std::size_t frames,
+        SDL_AudioFormat format, uint16_t channels, void *out);
+
+}
+
+}
+
+#endif // end SEWENEW_ASSISTANT_PCM_H
@@ -0,0 +1,358 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/pipeline.h"
+#include <algorithm>
+#include <cstring>
+#include "sw/assistant/errors.h"
+#include "sw/assistant/pcm.h"
+
+namespace sw::assistant {
+
+namespace {
+
+// VAD and ASR take 16 kHz mono audio.
+constexpr int SAMPLE_RATE = 16000;
+
+int64_t to_samples(std::chrono::milliseconds duration) {
+    return duration.count() * SAMPLE_RATE / 1000;
+}
+
+int64_t to_ms(int64_t samples) {
+    return samples * 1000 / SAMPLE_RATE;
+}
+
+}
+
+Pipeline::QueueMetrics::QueueMetrics(const std::string &queue) :
+    depth(MetricsRegistry::instance().histogram("assistant_pipeline_queue_depth",
+                "Number of queued items of pipeline queue after each push",
+                {{"queue", queue}}, Histogram::exponential(1, 2, 12))),
+    dropped(MetricsRegistry::instance().counter("assistant_pipeline_queue_dropped_total",
+                "Number of items dropped because pipeline queue was full", {{"queue", queue}})) {}
+
+Pipeline::Pipeline(AudioSource &source, VadModel &vad, Asr &asr,
+        TranscriptCallback callback, const PipelineOptions &opts) :
+    _source(source),
+    _vad(vad),
+    _asr(asr),
+    _callback(std::move(callback)),
+    _opts(opts),
+    _capture_queue(opts.capture_queue, source.live() ? opts.capture_policy : QueuePolicy::BLOCK),
+    _audio_queue(opts.audio_queue, opts.audio_policy),
+    _speech_queue(opts.speech_queue, opts.speech_policy),
+    _transcript_latency(MetricsRegistry::instance().histogram("assistant_pipeline_transcript_latency_seconds",
+                "Time since end of speech is detected until it's transcribed")) {
+    _opts.vad.sample_rate = SAMPLE_RATE;
+}
+
+Pipeline::~Pipeline() {
+    try {
+        stop();
+    } catch (...) {
+        // Avoid throwing from destructor.
+    }
+}
+
+void Pipeline::start() {
+    if (!_threads.empty() || _capture_queue.closed()) {
+        throw Error("pipeline can only be started once");
+    }
+
+    _source.start();
+
+    _running.store(true, std::memory_order_release);
+
+    _threads.emplace_back(&Pipeline::_run_stage, this, &Pipeline::_capture);
+    _threads.emplace_back(&Pipeline::_run_stage, this, &Pipeline::_resample);
+    _threads.emplace_back(&Pipeline::_run_stage, this, &Pipeline::_detect);
+    _threads.emplace_back(&Pipeline::_run_stage, this, &Pipeline::_recognize);
+}
+
+void Pipeline::stop() {
+    if (_threads.empty()) {
+        return;
+    }
+
+    // Capture stops first, and the other stages exit once they've drained their input.
+    _running.store(false, std::memory_order_release);
+
+    _join();
+}
+
+void Pipeline::wait() {
+    if (_threads.empty()) {
+        return;
+    }
+
+    _join();
+}
+
+void Pipeline::_join() {
+    for (auto &thread : _threads) {
+        thread.join();
+    }
+    _threads.clear();
+
+    _source.stop();
+
+    std::exception_ptr err;
+    {
+        std::lock_guard<std::mutex> lock(_error_mutex);
+        std::swap(err, _error);
+    }
+
+    if (err) {
+        std::rethrow_exception(err);
+    }
+}
+
+PipelineStats Pipeline::stats() const {
+    PipelineStats stats;
+    stats.capture = _capture_queue.stats();
+    stats.audio = _audio_queue.stats();
+    stats.speech = _speech_queue.stats();
+
+    return stats;
+}
+
+void Pipeline::_run_stage(void (Pipeline::*stage)()) {
+    try {
+        (this->*stage)();
+    } catch (...) {
+        _fail(std::current_exception());
+    }
+}
+
+void Pipeline::_capture() {
+    auto opts = _source.options();
+    auto frame_size = pcm::sample_size(opts.format) * opts.channels;
+
+    Chunk<uint8_t> chunk;
+    int64_t dropped = 0;
+    while (_running.load(std::memory_order_acquire)) {
+        auto regions = _source.peek();
+        auto size = regions.size() / frame_size * frame_size;
+        if (size == 0) {
+            if (_source.finished()) {
+                break;
+            }
+
+            std::this_thread::sleep_for(_opts.poll_interval);
+            continue;
+        }
+
+        auto &data = chunk.data;
+        data.resize(size);
+        auto first = std::min(size, regions.first.size());
+        std::memcpy(data.data(), regions.first.data(), first);
+        std::memcpy(data.data() + first, regions.second.data(), size - first);
+        _source.consume(size);
+
+        // If it's dropped, i.e. downstream is too slow, the chunk is reused,
+        // and the next one carries the gap.
+        chunk.dropped = dropped;
+        if (_push(_capture_queue, chunk, _capture_metrics)) {
+            dropped = 0;
+        } else {
+            dropped += static_cast<int64_t>(size / frame_size);
+        }
+    }
+
+    _capture_queue.close();
+}
+
+void Pipeline::_resample() {
+    auto opts = _source.options();
+    auto frame_size = pcm::sample_size(opts.format) * opts.channels;
+
+    std::unique_ptr<Resampler> resampler;
+    if (opts.sample_per_second != SAMPLE_RATE) {
+        resampler = std::make_unique<Resampler>(static_cast<int>(opts.sample_per_second), SAMPLE_RATE);
+    }
+
+    Chunk<uint8_t> chunk;
+    std::vector<float> mono;
+    Chunk<float> audio;
+    // Samples at 16 kHz dropped by either queue, which have not been passed on yet.
+    int64_t dropped = 0;
+    auto push = [&]() {
+        if (audio.data.empty()) {
+            return;
+        }
+
+        audio.dropped = dropped;
+        if (_push(_audio_queue, audio, _audio_metrics)) {
+            dropped = 0;
+        } else {
+            dropped += static_cast<int64_t>(audio.data.size());
+        }
+    };
+
+    auto flush = [&]() {
+        if (resampler) {
+            audio.data.resize(resampler->max_output(0));
+            audio.data.resize(resampler->flush(audio.data.data()));
+            push();
+        }
+    };
+
+    while (_capture_queue.pop(chunk)) {
+        if (chunk.dropped > 0) {
+            // Audio before the gap is not filtered with audio after it, since flush resets the resampler.
+            flush();
+            dropped += chunk.dropped * SAMPLE_RATE / static_cast<int64_t>(opts.sample_per_second);
+        }
+
+        auto frames = chunk.data.size() / frame_size;
+        auto &converted = resampler ? mono : audio.data;
+        converted.resize(frames);
+        pcm::to_mono_f32(chunk.data.data(), chunk.data.size(), opts.format, opts.channels, converted.data());
+
+        if (resampler) {
+            audio.data.resize(resampler->max_output(frames));
+            audio.data.resize(resampler->process(mono, audio.data.data()));
+        }
+
+        push();
+    }
+
+    flush();
+
+    _audio_queue.close();
+}
+
+void Pipeline::_detect() {
+    // Audio that might still be part of an utterance, which starts at sample `history_start`.
+    std::vector<float> history;
+    int64_t history_start = 0;
+
+    bool in_speech = false;
+    int64_t speech_start = 0;
+
+    Utterance utterance;
+    auto emit = [&](int64_t start, int64_t end) {
+        auto history_end = history_start + static_cast<int64_t>(history.size());
+        start = std::max(start, history_start);
+        end = std::min(end, history_end);
+        if (end <= start) {
+            return;
+        }
+
+        utterance.samples.assign(history.begin() + (start - history_start),
+                history.begin() + (end - history_start));
+        utterance.start_ms = to_ms(start);
+        utterance.end_ms = to_ms(end);
+        utterance.detected = std::chrono::steady_clock::now();
+        _push(_speech_queue, utterance, _speech_metrics);
+    };
+
+    VadSession session(_vad, [&](const VadEvent &event) {
+        if (event.type == VadEventType::SPEECH_START) {
+            in_speech = true;
+            speech_start = event.chunk.start;
+        } else {
+            in_speech = false;
+            emit(speech_start, event.chunk.end);
+        }
+    }, _opts.vad);
+
+    auto max_speech = to_samples(_opts.max_speech);
+    // SPEECH_START is raised once speech lasts `min_speech`, and it starts `speech_pad` earlier.
+    // Speech shorter than `min_speech` can be followed by a pause of up to `min_silence` before
+    // SPEECH_START is raised, and the event still starts with the earlier speech.
+    auto keep = to_samples(_opts.vad.speech_pad + _opts.vad.min_speech + _opts.vad.min_silence +
+            _opts.vad.window_size + std::chrono::seconds(1));
+
+    Chunk<float> chunk;
+    while (_audio_queue.pop(chunk)) {
+        if (chunk.dropped > 0) {
+            // Utterances can't span the gap, and VAD restarts after it at the right position.
+            auto history_end = history_start + static_cast<int64_t>(history.size());
+            session.skip(chunk.dropped);
+            in_speech = false;
+            history.clear();
+            history_start = history_end + chunk.dropped;
+        }
+
+        const auto &audio = chunk.data;
+        history.insert(history.end(), audio.begin(), audio.end());
+        session.feed(audio);
+
+        auto history_end = history_start + static_cast<int64_t>(history.size());
+        if (in_speech && max_speech > 0 && history_end - speech_start >= max_speech) {
+            emit(speech_start, history_end);
+            speech_start = history_end;
+        }
+
+        // Drop audio that can't be part of an utterance, and compact once half of the buffer is dropped.
+        auto keep_from = in_speech ? speech_start : history_end - keep;
+        auto drop = keep_from - history_start;
+        if (drop > 0 && static_cast<std::size_t>(drop) * 2 >= history.size()) {
+            history.erase(history.begin(), history.begin() + drop);
+            history_start = keep_from;
+        }
+    }
+
+    session.flush();
+
+    _speech_queue.close();
+}
+
+void Pipeline::_recognize() {
+    Utterance utterance;
+    while (_speech_queue.pop(utterance)) {
+        Transcript transcript;
+        transcript.text = _asr.recognize(AudioView(Span<const float>(utterance.samples), SAMPLE_RATE));
+        transcript.start_ms = utterance.start_ms;
+        transcript.end_ms = utterance.end_ms;
+
+        _transcript_latency.observe(std::chrono::steady_clock::now() - utterance.detected);
+
+        _callback(transcript);
+    }
+}
+
+template <typename T>
+bool Pipeline::_push(SpscQueue<T> &queue, T &item, QueueMetrics &metrics) {
+    if (queue.push(item)) {
+        metrics.depth.observe(static_cast<double>(queue.size()));
+        return true;
+    }
+
+    if (!queue.closed()) {
+        metrics.dropped.add();
+    }
+
+    return false;
+}
+
+void Pipeline::_fail(std::exception_ptr err) {
+    {
+        std::lock_guard<std::mutex> lock(_error_mutex);
+        if (!_error) {
+            _error = err;
+        }
+    }
+
+    // Unblock all stages, so that they exit.
+    _running.store(false, std::memory_order_release);
+    _capture_queue.close();
+    _audio_queue.close();
+    _speech_queue.close();
+}
+
+}
@@ -0,0 +1,200 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_PIPELINE_H
+#define SEWENEW_ASSISTANT_PIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sw/assistant/asr.h"
+#include "sw/assistant/audio_source.h"
+#include "sw/assistant/metrics.h"
+#include "sw/assistant/resampler.h"
+#include "sw/assistant/spsc_queue.h"
+#include "sw/assistant/vad.h"
+
+namespace sw::assistant {
+
+struct PipelineOptions {
+    // Capacity of each queue, in number of items, and what to do when it's full.
+    // Capture never waits by default, i.e. if downstream stages fall behind,
+    // audio is dropped and counted, instead of overrunning the recorder. Timestamps of later
+    // transcripts still count the dropped audio, and utterances never span a gap.
+    // For sources which are not live, e.g. files, capture always waits.
+    std::size_t capture_queue = 256;
+    QueuePolicy capture_policy = QueuePolicy::DROP_NEWEST;
+
+    std::size_t audio_queue = 256;
+    QueuePolicy audio_policy = QueuePolicy::BLOCK;
+
+    std::size_t speech_queue = 16;
+    QueuePolicy speech_policy = QueuePolicy::BLOCK;
+
+    // How often the capture stage polls the source when no audio is available.
+    std::chrono::milliseconds poll_interval{10};
+
+    // VadOptions::sample_rate is ignored, since VAD always runs on 16 kHz audio.
+    VadOptions vad;
+
+    // Speech longer than it is cut into several utterances, e.g. whisper takes at most 30 seconds.
+    std::chrono::milliseconds max_speech{std::chrono::seconds(30)};
+};
+
+struct Transcript {
+    std::string text;
+
+    // In milliseconds, relative to the start of the pipeline.
+    int64_t start_ms = 0;
+    int64_t end_ms = 0;
+};
+
+struct PipelineStats {
+    // Source -> resample.
+    QueueStats capture;
+
+    // Resample -> VAD.
+    QueueStats audio;
+
+    // VAD -> ASR.
+    QueueStats speech;
+};
+
+// Capture -> resample -> VAD -> ASR, each stage running on its own thread, and linked
+// by bounded SPSC queues. So capture never stops while ASR is busy, and latency is bounded
+// by the slowest stage instead of the sum of all stages.
+// A recorder should be in ring buffer mode, i.e. AudioRecorderOptions::ring_buffer > 0.
+// The pipeline owns the source between `start` and `stop`.
+class Pipeline {
+public:
+    using TranscriptCallback = std::function<void (const Transcript &)>;
+
+    Pipeline(AudioSource &source, VadModel &vad, Asr &asr,
+            TranscriptCallback callback, const PipelineOptions &opts = {});
+
+    Pipeline(const Pipeline &) = delete;
+    Pipeline& operator=(const Pipeline &) = delete;
+
+    Pipeline(Pipeline &&) = delete;
+    Pipeline& operator=(Pipeline &&) = delete;
+
+    ~Pipeline();
+
+    void start();
+
+    // Stop capture, and wait for audio captured so far to be transcribed.
+    // Rethrows the first error raised by any stage.
+    void stop();
+
+    // Wait for the source to finish, e.g. end of file, and all its audio to be transcribed.
+    // It never returns for live sources, unless a stage fails. Rethrows as `stop` does.
+    void wait();
+
+    PipelineStats stats() const;
+
+private:
+    // Audio of a single speech segment.
+    struct Utterance {
+        std::vector<float> samples;
+        int64_t start_ms = 0;
+        int64_t end_ms = 0;
+
+        // When the end of speech is detected.
+        std::chrono::steady_clock::time_point detected;
+    };
+
+    struct QueueMetrics {
+        QueueMetrics(const std::string &queue);
+
+        // Number of queued items after each push.
+        Histogram &depth;
+
+        Counter &dropped;
+    };
+
+    // Audio passed between stages.
+    template <typename T>
+    struct Chunk {
+        std::vector<T> data;
+
+        // Frames dropped right before this chunk, so that later stages keep the timeline of the source.
+        int64_t dropped = 0;
+    };
+
+    // Push and update metrics of the queue. Returns false if the item is dropped.
+    template <typename T>
+    bool _push(SpscQueue<T> &queue, T &item, QueueMetrics &metrics);
+
+    void _run_stage(void (Pipeline::*stage)());
+
+    void _capture();
+
+    void _resample();
+
+    void _detect();
+
+    void _recognize();
+
+    void _fail(std::exception_ptr err);
+
+    void _join();
+
+    AudioSource &_source;
+
+    VadModel &_vad;
+
+    Asr &_asr;
+
+    TranscriptCallback _callback;
+
+    PipelineOptions _opts;
+
+    // Interleaved audio in source's format. Dropped frames are in source's sample rate.
+    SpscQueue<Chunk<uint8_t>> _capture_queue;
+
+    // Mono float32 audio at 16 kHz.
+    SpscQueue<Chunk<float>> _audio_queue;
+
+    SpscQueue<Utterance> _speech_queue;
+
+    QueueMetrics _capture_metrics{"capture"};
+
+    QueueMetrics _audio_metrics{"audio"};
+
+    QueueMetrics _speech_metrics{"speech"};
+
+    // Time since end of speech is detected until it's transcribed.
+    Histogram &_transcript_latency;
+
+    std::atomic<bool> _running{false};
+
+    std::vector<std::thread> _threads;
+
+    std::mutex _error_mutex;
+
+    std::exception_ptr _error;
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_PIPELINE_H
@@ -0,0 +1,251 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/resampler.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include "sw/assistant/errors.h"
+#include "sw/assistant/simd.h"
+
+namespace sw::assistant {
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+
+// Taps per phase is kept as a multiple of this, so that SIMD kernels need no tail.
+constexpr std::size_t TAPS_ALIGNMENT = 8;
+
+double sinc(double x) {
+    if (std::abs(x) < 1e-9) {
+        return 1.0;
+    }
+
+    return std::sin(PI * x) / (PI * x);
+}
+
+// Zeroth order modified Bessel function of the first kind.
+double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (auto k = 1; k < 50; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+double kaiser(double x, double beta) {
+    if (std::abs(x) > 1.0) {
+        return 0.0;
+    }
+
+    return bessel_i0(beta * std::sqrt(1.0 - x * x)) / bessel_i0(beta);
+}
+
+#if defined(SW_ASSISTANT_AVX2)
+
+SW_ASSISTANT_TARGET_AVX2
+float dot_avx2(const float *x, const float *h, std::size_t size) {
+    auto acc0 = _mm256_setzero_ps();
+    auto acc1 = _mm256_setzero_ps();
+    std::size_t idx = 0;
+    for (; idx + 16 <= size; idx += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + idx), _mm256_loadu_ps(h + idx), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + idx + 8), _mm256_loadu_ps(h + idx + 8), acc1);
+    }
+    for (; idx < size; idx += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + idx), _mm256_loadu_ps(h + idx), acc0);
+    }
+
+    auto acc = _mm256_add_ps(acc0, acc1);
+    auto sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+#endif
+
+#if defined(SW_ASSISTANT_SSE2)
+
+float dot_vec(const float *x, const float *h, std::size_t size) {
+    auto acc0 = _mm_setzero_ps();
+    auto acc1 = _mm_setzero_ps();
+    for (std::size_t idx = 0; idx < size; idx += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + idx), _mm_loadu_ps(h + idx)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + idx + 4), _mm_loadu_ps(h + idx + 4)));
+    }
+
+    auto sum = _mm_add_ps(acc0, acc1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+#elif defined(SW_ASSISTANT_NEON)
+
+float dot_vec(const float *x, const float *h, std::size_t size) {
+    auto acc0 = vdupq_n_f32(0.0f);
+    auto acc1 = vdupq_n_f32(0.0f);
+    for (std::size_t idx = 0; idx < size; idx += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(x + idx), vld1q_f32(h + idx));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(x + idx + 4), vld1q_f32(h + idx + 4));
+    }
+
+    return vaddvq_f32(vaddq_f32(acc0, acc1));
+}
+
+#else
+
+float dot_vec(const float *x, const float *h, std::size_t size) {
+    float sum = 0.0f;
+    for (std::size_t idx = 0; idx < size; ++idx) {
+        sum += x[idx] * h[idx];
+    }
+    return sum;
+}
+
+#endif
+
+}
+
+Resampler::Resampler(int in_rate, int out_rate, const ResamplerOptions &opts) :
+    _in_rate(in_rate), _out_rate(out_rate), _block_size(opts.block_size) {
+    if (in_rate <= 0 || out_rate <= 0) {
+        throw Error("invalid sample rate");
+    }
+
+    if (opts.zero_crossings <= 0 || opts.cutoff <= 0.0f || opts.cutoff > 1.0f || opts.block_size == 0) {
+        throw Error("invalid resampler options");
+    }
+
+    auto gcd = std::gcd(in_rate, out_rate);
+    _up = out_rate / gcd;
+    _down = in_rate / gcd;
+
+    _init_filter(opts);
+
+    // History of at most _taps - 1 samples, plus a block of input or the flush padding.
+    _buffer.resize(_taps + std::max(_block_size, _half));
+
+#if defined(SW_ASSISTANT_AVX2)
+    _dot = simd::has_avx2() ? dot_avx2 : dot_vec;
+#else
+    _dot = dot_vec;
+#endif
+
+    reset();
+}
+
+std::size_t Resampler::max_output(std::size_t in_size) const {
+    // Pending input in the history, plus new input, plus the flush padding.
+    return (in_size + _taps) * _up / _down + 2;
+}
+
+std::size_t Resampler::process(Span<const float> in, float *out) {
+    std::size_t num = 0;
+    while (!in.empty()) {
+        auto size = std::min(in.size(), _block_size);
+        num += _process_block(in.data(), size, out + num);
+        in = in.subspan(size);
+    }
+
+    return num;
+}
+
+std::size_t Resampler::flush(float *out) {
+    assert(_size + _half <= _buffer.size());
+
+    // Feed silence, so that output catches up with the last input sample.
+    std::fill_n(_buffer.data() + _size, _half, 0.0f);
+    auto num = _process_block(nullptr, _half, out);
+
+    reset();
+
+    return num;
+}
+
+void Resampler::reset() {
+    // Input before the stream starts is taken as silence.
+    _size = _half - 1;
+    std::fill_n(_buffer.data(), _size, 0.0f);
+    _offset = _half - 1;
+    _phase = 0;
+}
+
+void Resampler::_init_filter(const ResamplerOptions &opts) {
+    // In units of input samples, the prototype lowpass is scale * sinc(scale * t),
+    // with scale < 1 when downsampling, to cut off above the output's Nyquist frequency.
+    auto scale = std::min(1.0, static_cast<double>(_up) / _down) * opts.cutoff;
+    auto half = static_cast<std::size_t>(std::ceil(opts.zero_crossings / scale));
+    _half = (half + TAPS_ALIGNMENT / 2 - 1) / (TAPS_ALIGNMENT / 2) * (TAPS_ALIGNMENT / 2);
+    _taps = 2 * _half;
+
+    // Output sample at input position `base + phase / up` is the dot product of
+    // x[base - half + 1, base + half] with row `phase` of the filter bank.
+    _filter.resize(_up * _taps);
+    for (uint64_t phase = 0; phase < _up; ++phase) {
+        auto *coeffs = _filter.data() + phase * _taps;
+        double sum = 0.0;
+        for (std::size_t tap = 0; tap < _taps; ++tap) {
+            auto t = static_cast<double>(phase) / _up + static_cast<double>(_half) - 1.0 - tap;
+            auto val = scale * sinc(scale * t) * kaiser(t / _half, opts.kaiser_beta);
+            coeffs[tap] = static_cast<float>(val);
+            sum += val;
+        }
+
+        // Normalize each phase to unity DC gain.
+        for (std::size_t tap = 0; tap < _taps; ++tap) {
+            coeffs[tap] = static_cast<float>(coeffs[tap] / sum);
+        }
+    }
+}
+
+std::size_t Resampler::_process_block(const float *in, std::size_t size, float *out) {
+    assert(_size + size <= _buffer.size());
+
+    if (in != nullptr) {
+        std::memcpy(_buffer.data() + _size, in, size * sizeof(float));
+    }
+    _size += size;
+
+    std::size_t num = 0;
+    while (_offset + _half < _size) {
+        out[num++] = _dot(_buffer.data() + _offset + 1 - _half, _filter.data() + _phase * _taps, _taps);
+
+        _phase += _down;
+        _offset += _phase / _up;
+        _phase %= _up;
+    }
+
+    // Drop input that's no longer needed, i.e. before the first tap of the next output.
+    // When downsampling, the next output might start beyond the buffered input.
+    auto drop = std::min(_offset + 1 - _half, _size);
+    std::memmove(_buffer.data(), _buffer.data() + drop, (_size - drop) * sizeof(float));
+    _size -= drop;
+    _offset -= drop;
+
+    return num;
+}
+
+}
@@ -0,0 +1,115 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_RESAMPLER_H
+#define SEWENEW_ASSISTANT_RESAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "sw/assistant/span.h"
+
+namespace sw::assistant {
+
+struct ResamplerOptions {
+    // Zero crossings of the windowed sinc on each side. More crossings, sharper transition band.
+    int zero_crossings = 16;
+
+    // Cutoff frequency relative to the Nyquist frequency of the lower sample rate.
+    float cutoff = 0.95f;
+
+    // Beta of the Kaiser window, i.e. tradeoff between stopband attenuation and transition width.
+    float kaiser_beta = 8.6f;
+
+    // Input is processed in blocks of at most `block_size` samples,
+    // so that the resampler never allocates after construction.
+    std::size_t block_size = 4096;
+};
+
+// Streaming polyphase windowed-sinc resampler for mono float32 audio, which converts
+// between arbitrary integer sample rates, e.g. 44100, 48000 or 8000 to 16000.
+// Filter history is kept across calls, so audio can be processed in chunks of any size.
+// NOTE: it's NOT thread-safe.
+class Resampler {
+public:
+    Resampler(int in_rate, int out_rate, const ResamplerOptions &opts = {});
+
+    int in_rate() const {
+        return _in_rate;
+    }
+
+    int out_rate() const {
+        return _out_rate;
+    }
+
+    // Upper bound of the number of samples written by `process` for `in_size` input samples.
+    std::size_t max_output(std::size_t in_size) const;
+
+    // Resample `in` to `out`, which should hold at least `max_output(in.size())` samples.
+    // Returns the number of samples written. Output lags input by half of the filter length,
+    // call `flush` at end of stream to get the remaining output.
+    std::size_t process(Span<const float> in, float *out);
+
+    // Flush the filter with silence. `out` should hold at least `max_output(0)` samples.
+    std::size_t flush(float *out);
+
+    void reset();
+
+private:
+    void _init_filter(const ResamplerOptions &opts);
+
+    std::size_t _process_block(const float *in, std::size_t size, float *out);
+
+    using DotKernel = float (*)(const float *x, const float *h, std::size_t size);
+
+    int _in_rate = 0;
+
+    int _out_rate = 0;
+
+    // Interpolation factor, i.e. number of phases.
+    uint64_t _up = 1;
+
+    // Decimation factor.
+    uint64_t _down = 1;
+
+    // Taps per phase, padded to a multiple of SIMD width.
+    std::size_t _taps = 0;
+
+    // Number of taps on each side of the current input sample.
+    std::size_t _half = 0;
+
+    std::size_t _block_size = 0;
+
+    // _up phases x _taps coefficients.
+    std::vector<float> _filter;
+
+    // Input history followed by new input.
+    std::vector<float> _buffer;
+
+    std::size_t _size = 0;
+
+    // Index in _buffer of the input sample at, or just before, the next output sample.
+    std::size_t _offset = 0;
+
+    // Phase of the next output sample, in [0, _up).
+    uint64_t _phase = 0;
+
+    DotKernel _dot = nullptr;
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_RESAMPLER_H
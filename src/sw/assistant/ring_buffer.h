@@ -0,0 +1,160 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_RING_BUFFER_H
+#define SEWENEW_ASSISTANT_RING_BUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include "sw/assistant/errors.h"
+#include "sw/assistant/span.h"
+
+namespace sw::assistant {
+
+// Lock-free ring buffer with a single producer and a single consumer.
+// The capacity is fixed at construction, and rounded up to a power of 2,
+// so that neither write nor read allocates.
+template <typename T>
+class RingBuffer {
+public:
+    static_assert(std::is_trivially_copyable_v<T>, "RingBuffer only holds trivially copyable types");
+
+    // Readable data might wrap around the end of the buffer,
+    // so it's exposed as at most 2 contiguous regions.
+    struct Regions {
+        Span<const T> first;
+        Span<const T> second;
+
+        std::size_t size() const {
+            return first.size() + second.size();
+        }
+    };
+
+    explicit RingBuffer(std::size_t capacity) {
+        if (capacity == 0) {
+            throw Error("ring buffer capacity should be greater than 0");
+        }
+
+        std::size_t cap = 1;
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+
+        _buffer = std::make_unique<T[]>(cap);
+        _capacity = cap;
+        _mask = cap - 1;
+    }
+
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer& operator=(const RingBuffer &) = delete;
+
+    RingBuffer(RingBuffer &&) = delete;
+    RingBuffer& operator=(RingBuffer &&) = delete;
+
+    std::size_t capacity() const noexcept {
+        return _capacity;
+    }
+
+    // Number of readable elements. It's exact only when called by producer or consumer.
+    std::size_t size() const noexcept {
+        return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+    }
+
+    // Producer only. Returns the number of elements written, which is less than
+    // `size` if there's not enough free space, i.e. the remaining elements are dropped.
+    std::size_t write(const T *data, std::size_t size) noexcept {
+        auto head = _head.load(std::memory_order_relaxed);
+        auto tail = _tail.load(std::memory_order_acquire);
+
+        auto num = std::min(size, _capacity - (head - tail));
+        _copy_in(head, data, num);
+
+        _head.store(head + num, std::memory_order_release);
+
+        return num;
+    }
+
+    // Consumer only. Returns the readable data without copying it.
+    // Call `consume` after the data has been processed.
+    Regions peek() const noexcept {
+        auto tail = _tail.load(std::memory_order_relaxed);
+        auto head = _head.load(std::memory_order_acquire);
+
+        auto num = head - tail;
+        auto offset = tail & _mask;
+        auto first = std::min(num, _capacity - offset);
+
+        return {Span<const T>(_buffer.get() + offset, first),
+                Span<const T>(_buffer.get(), num - first)};
+    }
+
+    // Consumer only.
+    void consume(std::size_t size) noexcept {
+        auto tail = _tail.load(std::memory_order_relaxed);
+
+        assert(size <= _head.load(std::memory_order_acquire) - tail);
+
+        _tail.store(tail + size, std::memory_order_release);
+    }
+
+    // Consumer only. Copies at most `size` elements to `out`, and returns the number copied.
+    std::size_t read(T *out, std::size_t size) noexcept {
+        auto regions = peek();
+
+        auto first = std::min(size, regions.first.size());
+        std::memcpy(out, regions.first.data(), first * sizeof(T));
+
+        auto second = std::min(size - first, regions.second.size());
+        std::memcpy(out + first, regions.second.data(), second * sizeof(T));
+
+        consume(first + second);
+
+        return first + second;
+    }
+
+    // Consumer only. Discards all readable data.
+    void clear() noexcept {
+        _tail.store(_head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    void _copy_in(std::size_t head, const T *data, std::size_t num) noexcept {
+        auto offset = head & _mask;
+        auto first = std::min(num, _capacity - offset);
+        std::memcpy(_buffer.get() + offset, data, first * sizeof(T));
+        std::memcpy(_buffer.get(), data + first, (num - first) * sizeof(T));
+    }
+
+    std::unique_ptr<T[]> _buffer;
+
+    std::size_t _capacity = 0;
+
+    std::size_t _mask = 0;
+
+    // Write index, only modified by producer.
+    alignas(64) std::atomic<std::size_t> _head{0};
+
+    // Read index, only modified by consumer.
+    alignas(64) std::atomic<std::size_t> _tail{0};
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_RING_BUFFER_H
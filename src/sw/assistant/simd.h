@@ -0,0 +1,59 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_SIMD_H
+#define SEWENEW_ASSISTANT_SIMD_H
+
+// Instruction sets available to SIMD kernels. SSE2 and NEON are baseline on x86-64 and AArch64,
+// other targets only get scalar kernels.
+// AVX2 kernels are compiled with target attributes, and selected at runtime with `has_avx2`.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+
+#define SW_ASSISTANT_SSE2 1
+#include <immintrin.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SW_ASSISTANT_AVX2 1
+#define SW_ASSISTANT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#elif defined(__AVX2__)
+#define SW_ASSISTANT_AVX2 1
+#define SW_ASSISTANT_TARGET_AVX2
+#endif
+
+#elif defined(__aarch64__)
+
+#define SW_ASSISTANT_NEON 1
+#include <arm_neon.h>
+
+#endif
+
+namespace sw::assistant::simd {
+
+inline bool has_avx2() {
+#if defined(SW_ASSISTANT_AVX2) && (defined(__GNUC__) || defined(__clang__))
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return supported;
+#elif defined(SW_ASSISTANT_AVX2)
+    return true;
+#else
+    return false;
+#endif
+}
+
+}
+
+#endif // end SEWENEW_ASSISTANT_SIMD_H
@@ -0,0 +1,97 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_SPAN_H
+#define SEWENEW_ASSISTANT_SPAN_H
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+namespace sw::assistant {
+
+// Non-owning view of a contiguous sequence of T, i.e. a minimal std::span for C++17.
+template <typename T>
+class Span {
+public:
+    using element_type = T;
+    using value_type = std::remove_cv_t<T>;
+    using iterator = T*;
+
+    Span() = default;
+
+    Span(T *data, std::size_t size) : _data(data), _size(size) {}
+
+    template <typename U,
+             typename = std::enable_if_t<std::is_convertible_v<U (*)[], T (*)[]>>>
+    Span(const Span<U> &other) : _data(other.data()), _size(other.size()) {}
+
+    template <typename Alloc, typename U = T,
+             typename = std::enable_if_t<std::is_const_v<U>>>
+    Span(const std::vector<value_type, Alloc> &vec) : _data(vec.data()), _size(vec.size()) {}
+
+    template <typename Alloc>
+    Span(std::vector<value_type, Alloc> &vec) : _data(vec.data()), _size(vec.size()) {}
+
+    T* data() const noexcept {
+        return _data;
+    }
+
+    std::size_t size() const noexcept {
+        return _size;
+    }
+
+    std::size_t size_bytes() const noexcept {
+        return _size * sizeof(T);
+    }
+
+    bool empty() const noexcept {
+        return _size == 0;
+    }
+
+    T& operator[](std::size_t idx) const {
+        assert(idx < _size);
+
+        return _data[idx];
+    }
+
+    iterator begin() const noexcept {
+        return _data;
+    }
+
+    iterator end() const noexcept {
+        return _data + _size;
+    }
+
+    Span subspan(std::size_t offset, std::size_t count = static_cast<std::size_t>(-1)) const {
+        assert(offset <= _size);
+
+        if (count > _size - offset) {
+            count = _size - offset;
+        }
+
+        return Span(_data + offset, count);
+    }
+
+private:
+    T *_data = nullptr;
+    std::size_t _size = 0;
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_SPAN_H
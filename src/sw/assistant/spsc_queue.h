@@ -0,0 +1,216 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_SPSC_QUEUE_H
+#define SEWENEW_ASSISTANT_SPSC_QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include "sw/assistant/errors.h"
+
+namespace sw::assistant {
+
+// What to do when producer pushes to a full queue.
+enum class QueuePolicy {
+    // Wait until consumer pops an item, i.e. backpressure to producer.
+    BLOCK = 0,
+
+    // Drop the pushed item, so that producer never waits.
+    DROP_NEWEST
+};
+
+struct QueueStats {
+    std::size_t size = 0;
+    std::size_t capacity = 0;
+
+    // Max number of queued items so far.
+    std::size_t high_watermark = 0;
+
+    // Number of items dropped with QueuePolicy::DROP_NEWEST.
+    uint64_t dropped = 0;
+};
+
+// Bounded queue linking 2 pipeline stages, with a single producer and a single consumer.
+// Push and pop are lock-free, and the mutex is only taken to park a waiting thread.
+// Items are swapped in and out of slots, so that buffers circulate between producer and
+// consumer, e.g. after pushing a std::vector, the producer gets back one that the consumer
+// has done with, whose capacity can be reused without allocation.
+template <typename T>
+class SpscQueue {
+public:
+    SpscQueue(std::size_t capacity, QueuePolicy policy) : _policy(policy) {
+        if (capacity == 0) {
+            throw Error("queue capacity should be greater than 0");
+        }
+
+        _items = std::make_unique<T[]>(capacity);
+        _capacity = capacity;
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue& operator=(const SpscQueue &) = delete;
+
+    SpscQueue(SpscQueue &&) = delete;
+    SpscQueue& operator=(SpscQueue &&) = delete;
+
+    // Producer only. Returns false if the item is dropped, or the queue is closed,
+    // and `item` is left untouched. Otherwise, `item` is swapped with a recycled one.
+    bool push(T &item) {
+        auto head = _head.load(std::memory_order_relaxed);
+        while (head - _tail.load(std::memory_order_acquire) == _capacity) {
+            if (_closed.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            if (_policy == QueuePolicy::DROP_NEWEST) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            _park(_producer_waiting, [this, head]() {
+                return head - _tail.load(std::memory_order_seq_cst) < _capacity;
+            });
+        }
+
+        if (_closed.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        using std::swap;
+        swap(_items[head % _capacity], item);
+        // seq_cst pairs with the check of `_consumer_waiting` below, see `_park`.
+        _head.store(head + 1, std::memory_order_seq_cst);
+
+        auto size = head + 1 - _tail.load(std::memory_order_relaxed);
+        if (size > _high_watermark.load(std::memory_order_relaxed)) {
+            _high_watermark.store(size, std::memory_order_relaxed);
+        }
+
+        _wake(_consumer_waiting);
+
+        return true;
+    }
+
+    // Consumer only. Block until an item is available, and swap it with `item`, i.e. the old
+    // value of `item` is recycled. Returns false if the queue is closed and all items have been popped.
+    bool pop(T &item) {
+        auto tail = _tail.load(std::memory_order_relaxed);
+        while (_head.load(std::memory_order_acquire) == tail) {
+            if (_closed.load(std::memory_order_acquire)) {
+                // Items pushed before close are still delivered.
+                if (_head.load(std::memory_order_acquire) == tail) {
+                    return false;
+                }
+                break;
+            }
+
+            _park(_consumer_waiting, [this, tail]() {
+                return _head.load(std::memory_order_seq_cst) != tail;
+            });
+        }
+
+        using std::swap;
+        swap(_items[tail % _capacity], item);
+        _tail.store(tail + 1, std::memory_order_seq_cst);
+
+        _wake(_producer_waiting);
+
+        return true;
+    }
+
+    // No more items will be pushed. Wake up both sides.
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closed.store(true, std::memory_order_release);
+        }
+        _cv.notify_all();
+    }
+
+    // Number of queued items. It's exact only when called by producer or consumer.
+    std::size_t size() const {
+        return static_cast<std::size_t>(_head.load(std::memory_order_acquire) -
+                _tail.load(std::memory_order_acquire));
+    }
+
+    bool closed() const {
+        return _closed.load(std::memory_order_acquire);
+    }
+
+    QueueStats stats() const {
+        QueueStats stats;
+        stats.size = size();
+        stats.capacity = _capacity;
+        stats.high_watermark = static_cast<std::size_t>(_high_watermark.load(std::memory_order_relaxed));
+        stats.dropped = _dropped.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    // The waiting flag is set before re-checking the condition, and the other side
+    // updates its index before checking the flag, both with seq_cst. So either this side
+    // sees the update, or the other side sees the flag and notifies under the mutex.
+    template <typename Ready>
+    void _park(std::atomic<bool> &waiting, Ready ready) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        waiting.store(true, std::memory_order_seq_cst);
+        _cv.wait(lock, [this, &ready]() {
+            return ready() || _closed.load(std::memory_order_acquire);
+        });
+        waiting.store(false, std::memory_order_relaxed);
+    }
+
+    void _wake(std::atomic<bool> &waiting) {
+        if (waiting.load(std::memory_order_seq_cst)) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+            }
+            _cv.notify_all();
+        }
+    }
+
+    std::unique_ptr<T[]> _items;
+
+    std::size_t _capacity = 0;
+
+    QueuePolicy _policy;
+
+    alignas(64) std::atomic<uint64_t> _head{0};
+
+    alignas(64) std::atomic<uint64_t> _tail{0};
+
+    std::atomic<uint64_t> _high_watermark{0};
+
+    std::atomic<uint64_t> _dropped{0};
+
+    std::atomic<bool> _closed{false};
+
+    std::atomic<bool> _producer_waiting{false};
+
+    std::atomic<bool> _consumer_waiting{false};
+
+    std::mutex _mutex;
+
+    std::condition_variable _cv;
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_SPSC_QUEUE_H
@@ -0,0 +1,111 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/synthetic_source.h"
+#include <algorithm>
+#include <cmath>
+#include "sw/assistant/errors.h"
+#include "sw/assistant/pcm.h"
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+
+uint64_t to_frames(std::chrono::milliseconds duration, uint32_t sample_rate) {
+    return static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0)) * sample_rate / 1000;
+}
+
+}
+
+namespace sw::assistant {
+
+SyntheticSource::SyntheticSource(SyntheticSourceOptions opts) :
+    _opts(std::move(opts)),
+    _pacer(_opts.speed, _opts.audio),
+    _gen(_opts.seed),
+    _noise(0.0f, std::max(_opts.noise, 1e-9f)) {
+    const auto &audio = _opts.audio;
+    _frame_size = pcm::sample_size(audio.format) * audio.channels;
+
+    _block_frames = to_frames(_opts.block, audio.sample_per_second);
+    if (_block_frames == 0) {
+        throw Error("invalid synthetic source block");
+    }
+
+    _tone_on_frames = to_frames(_opts.tone_on, audio.sample_per_second);
+    _tone_cycle_frames = _tone_on_frames + to_frames(_opts.tone_off, audio.sample_per_second);
+    _total_frames = to_frames(_opts.duration, audio.sample_per_second);
+
+    _mono.reserve(_block_frames);
+    _buffer.reserve(_block_frames * _frame_size);
+}
+
+void SyntheticSource::start() {
+    _pacer.start();
+}
+
+AudioRegions SyntheticSource::peek() {
+    if (_offset >= _buffer.size()) {
+        auto frames = std::min<uint64_t>(_block_frames, _pacer.available() / _frame_size);
+        if (_total_frames > 0) {
+            frames = std::min(frames, _total_frames - std::min(_frame, _total_frames));
+        }
+
+        _generate(static_cast<std::size_t>(frames));
+    }
+
+    AudioRegions regions;
+    regions.first = Span<const uint8_t>(_buffer.data() + _offset, _buffer.size() - _offset);
+
+    return regions;
+}
+
+void SyntheticSource::consume(std::size_t size) {
+    size = std::min(size, _buffer.size() - _offset);
+    _offset += size;
+    _pacer.consume(size);
+}
+
+void SyntheticSource::_generate(std::size_t frames) {
+    const auto rate = static_cast<double>(_opts.audio.sample_per_second);
+
+    _mono.resize(frames);
+    for (std::size_t idx = 0; idx < frames; ++idx, ++_frame) {
+        float sample = 0.0f;
+        if (_opts.noise > 0.0f) {
+            sample += _noise(_gen);
+        }
+
+        if (_opts.tone_amplitude > 0.0f && _tone_cycle_frames > 0 &&
+                _frame % _tone_cycle_frames < _tone_on_frames) {
+            // Phase is taken modulo 1 first, so that it stays precise for long runs.
+            auto phase = std::fmod(static_cast<double>(_frame) * _opts.tone_freq / rate, 1.0);
+            sample += _opts.tone_amplitude * static_cast<float>(std::sin(2.0 * PI * phase));
+        }
+
+        if (!_opts.clip.empty()) {
+            sample += _opts.clip[_frame % _opts.clip.size()];
+        }
+
+        _mono[idx] = sample;
+    }
+
+    _buffer.resize(frames * _frame_size);
+    pcm::from_mono_f32(_mono.data(), frames, _opts.audio.format, _opts.audio.channels, _buffer.data());
+    _offset = 0;
+}
+
+}
@@ -0,0 +1,119 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_SYNTHETIC_SOURCE_H
+#define SEWENEW_ASSISTANT_SYNTHETIC_SOURCE_H
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "sw/assistant/audio_source.h"
+#include "sw/assistant/wav.h"
+
+namespace sw::assistant {
+
+// Generated audio is the mix of a sine tone in bursts, white noise and a looped clip.
+struct SyntheticSourceOptions {
+    // Format of the generated audio.
+    WavOptions audio = {1, 16000, AUDIO_S16SYS};
+
+    // Tone is on for `tone_on`, and then off for `tone_off`, repeatedly. Disabled if amplitude is 0.
+    float tone_freq = 220.0f;
+    float tone_amplitude = 0.3f;
+    std::chrono::milliseconds tone_on{1000};
+    std::chrono::milliseconds tone_off{2000};
+
+    // Standard deviation of white Gaussian noise. Disabled if it's 0.
+    float noise = 0.01f;
+
+    // Mono float32 samples at `audio.sample_per_second`, e.g. recorded speech, which is looped.
+    std::vector<float> clip;
+
+    // If it's 0, the source never finishes.
+    std::chrono::milliseconds duration{0};
+
+    // Relative to real time, e.g. 50 for 50x. If it's 0, audio is generated as fast as it's consumed.
+    double speed = 1.0;
+
+    // Max audio returned by each `peek`.
+    std::chrono::milliseconds block{100};
+
+    uint32_t seed = 42;
+};
+
+// Audio is generated block by block, i.e. it runs without sound hardware or files.
+// NOTE: it's NOT thread-safe.
+class SyntheticSource : public AudioSource {
+public:
+    explicit SyntheticSource(SyntheticSourceOptions opts = {});
+
+    WavOptions options() const override {
+        return _opts.audio;
+    }
+
+    void start() override;
+
+    void stop() override {}
+
+    AudioRegions peek() override;
+
+    void consume(std::size_t size) override;
+
+    bool live() const override {
+        return false;
+    }
+
+    bool finished() const override {
+        return _total_frames > 0 && _frame >= _total_frames && _offset >= _buffer.size();
+    }
+
+private:
+    void _generate(std::size_t frames);
+
+    SyntheticSourceOptions _opts;
+
+    AudioPacer _pacer;
+
+    std::size_t _frame_size = 0;
+
+    std::size_t _block_frames = 0;
+
+    uint64_t _tone_on_frames = 0;
+
+    uint64_t _tone_cycle_frames = 0;
+
+    // 0 if it never finishes.
+    uint64_t _total_frames = 0;
+
+    // Index of the next frame to be generated.
+    uint64_t _frame = 0;
+
+    std::mt19937 _gen;
+
+    std::normal_distribution<float> _noise;
+
+    std::vector<float> _mono;
+
+    // Generated audio, and bytes of it that have been consumed.
+    std::vector<uint8_t> _buffer;
+
+    std::size_t _offset = 0;
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_SYNTHETIC_SOURCE_H
@@ -15,84 +15,184 @@
  *************************************************************************/
 
 #include "sw/assistant/vad.h"
-#include <cstring>
+#include <algorithm>
+#include "sw/assistant/errors.h"
+#include "sw/assistant/vad_scheduler.h"
+
+namespace {
+
+using namespace sw::assistant;
+
+int64_t to_samples(std::chrono::milliseconds duration, int sample_rate) {
+    return duration.count() * sample_rate / 1000;
+}
+
+bool pass_gate(VadGate &gate, VadState &state, Span<const float> window) {
+    if (!gate.enabled()) {
+        return true;
+    }
+
+    switch (gate.check(window)) {
+    case GateResult::SKIP:
+        return false;
+
+    case GateResult::RESET_AND_RUN:
+        // LSTM state is stale after a long run of skipped windows.
+        state.reset();
+        return true;
+
+    default:
+        return true;
+    }
+}
+
+}
 
 namespace sw::assistant {
 
-VadModel::VadModel(const std::string &model_path, int intra_threads, int inter_threads) {
-    _init_threads(_session_options, intra_threads, inter_threads);
+std::vector<Span<const float>> speech_spans(Span<const float> audio, const std::vector<SpeechChunk> &chunks) {
+    std::vector<Span<const float>> spans;
+    spans.reserve(chunks.size());
+    for (const auto &chunk : chunks) {
+        auto start = static_cast<std::size_t>(std::max<int64_t>(chunk.start, 0));
+        auto end = std::min(static_cast<std::size_t>(std::max<int64_t>(chunk.end, 0)), audio.size());
+        if (start < end) {
+            spans.push_back(audio.subspan(start, end - start));
+        }
+    }
 
-    _session = std::make_shared<Ort::Session>(_env, model_path.data(), _session_options);
+    return spans;
 }
 
-std::vector<SpeechChunk> VadModel::predict(std::vector<float> &audio_data, const VadOptions &opts) {
-    auto sample_rate_per_ms = opts.sample_rate / 1000;
-    auto min_silence = sample_rate_per_ms * opts.min_silence.count();
-    auto speech_pad = sample_rate_per_ms * opts.speech_pad.count();
-    auto window_size = sample_rate_per_ms * opts.window_size.count();
+VadState::VadState(int64_t window_size, int64_t sample_rate) :
+    _input(window_size), _sample_rate(1, sample_rate), _output(1) {
+    if (window_size <= 0) {
+        throw Error("invalid VAD window size");
+    }
+
+    auto memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeCPU);
 
     const int64_t input_node_dims[2] = {1, window_size};
 
+    const int64_t sr_node_dims[1] = {1};
+
     const int64_t hc_node_dims[3] = {2, 1, 64};
-    const int hc_size = 2 * 1 * 64;
-    std::vector<float> h(hc_size);
-    std::vector<float> c(hc_size);
 
-    const int64_t sr_node_dims[1] = {1};
-    std::vector<int64_t> sr = {opts.sample_rate};
+    const int64_t output_node_dims[2] = {1, 1};
+
+    for (auto idx = 0; idx < 2; ++idx) {
+        _h[idx].resize(HC_SIZE);
+        _c[idx].resize(HC_SIZE);
+    }
+
+    for (auto idx = 0; idx < 2; ++idx) {
+        auto &inputs = _inputs[idx];
+        inputs.reserve(4);
+        inputs.push_back(Ort::Value::CreateTensor<float>(memory_info, _input.data(), _input.size(), input_node_dims, 2));
+        inputs.push_back(Ort::Value::CreateTensor<int64_t>(memory_info, _sample_rate.data(), 1, sr_node_dims, 1));
+        inputs.push_back(Ort::Value::CreateTensor<float>(memory_info, _h[idx].data(), HC_SIZE, hc_node_dims, 3));
+        inputs.push_back(Ort::Value::CreateTensor<float>(memory_info, _c[idx].data(), HC_SIZE, hc_node_dims, 3));
+
+        auto &outputs = _outputs[idx];
+        outputs.reserve(3);
+        outputs.push_back(Ort::Value::CreateTensor<float>(memory_info, _output.data(), 1, output_node_dims, 2));
+        outputs.push_back(Ort::Value::CreateTensor<float>(memory_info, _h[1 - idx].data(), HC_SIZE, hc_node_dims, 3));
+        outputs.push_back(Ort::Value::CreateTensor<float>(memory_info, _c[1 - idx].data(), HC_SIZE, hc_node_dims, 3));
+    }
+}
+
+void VadState::reset() {
+    for (auto idx = 0; idx < 2; ++idx) {
+        std::fill(_h[idx].begin(), _h[idx].end(), 0.0f);
+        std::fill(_c[idx].begin(), _c[idx].end(), 0.0f);
+    }
+    _cur = 0;
+}
+
+VadModel::VadModel(const std::string &model_path, const VadModelOptions &opts) :
+    _infer_time(MetricsRegistry::instance().histogram("assistant_vad_infer_seconds",
+                "Time of VAD inference per window")),
+    _errors(MetricsRegistry::instance().counter("assistant_vad_errors_total",
+                "Number of failed VAD inferences")) {
+    auto &runtime = OnnxRuntime::instance();
+    if (opts.shared) {
+        _session = runtime.session(model_path, opts.session);
+    } else {
+        Ort::SessionOptions session_options;
+        _init_threads(session_options, opts.intra_threads, opts.inter_threads);
+
+        _session = runtime.create_session(model_path, opts.session, session_options);
+    }
+}
+
+std::vector<SpeechChunk> VadModel::predict(Span<const float> audio, const VadOptions &opts) {
+    VadState state(to_samples(opts.window_size, opts.sample_rate), opts.sample_rate);
+    auto window = state.window();
+
+    VadGate gate(opts.gate, opts.window_size);
 
     std::vector<VadChunk> chunks;
-    auto time_idx = SteadyTimePoint{};
-    for (auto idx = 0U; idx < audio_data.size(); idx += window_size) {
-        auto input_ort = Ort::Value::CreateTensor<float>(_memory_info, audio_data.data() + idx, window_size, input_node_dims, 2);
-        auto sr_ort = Ort::Value::CreateTensor<int64_t>(_memory_info, sr.data(), sr.size(), sr_node_dims, 1);
-        auto h_ort = Ort::Value::CreateTensor<float>(_memory_info, h.data(), h.size(), hc_node_dims, 3);
-        auto c_ort = Ort::Value::CreateTensor<float>(_memory_info, c.data(), c.size(), hc_node_dims, 3);
-        std::vector<Ort::Value> ort_inputs;
-        ort_inputs.push_back(std::move(input_ort));
-        ort_inputs.push_back(std::move(sr_ort));
-        ort_inputs.push_back(std::move(h_ort));
-        ort_inputs.push_back(std::move(c_ort));
-
-        float output = 0.0f;
-        try {
-            auto ort_outputs = _session->Run(Ort::RunOptions{nullptr},
-                    _input_node_names.data(), ort_inputs.data(), ort_inputs.size(),
-                    _output_node_names.data(), _output_node_names.size());
-            output = ort_outputs[0].GetTensorMutableData<float>()[0];
-            auto *hn = ort_outputs[1].GetTensorMutableData<float>();
-            std::memcpy(h.data(), hn, hc_size * sizeof(float));
-            auto *cn = ort_outputs[2].GetTensorMutableData<float>();
-            std::memcpy(c.data(), cn, hc_size * sizeof(float));
-        } catch (const Ort::Exception &e) {
-            output = -1.0f;
+    chunks.reserve((audio.size() + window.size() - 1) / window.size());
+    for (std::size_t idx = 0; idx < audio.size(); idx += window.size()) {
+        auto num = std::min(window.size(), audio.size() - idx);
+        std::copy_n(audio.data() + idx, num, window.data());
+        std::fill(window.begin() + num, window.end(), 0.0f);
+
+        auto output = 0.0f;
+        if (pass_gate(gate, state, window)) {
+            output = infer(state);
         }
 
-        chunks.emplace_back(SteadyTimePoint(time_idx),
-                SteadyTimePoint(time_idx + opts.window_size),
-                output);
-        time_idx += opts.window_size;
+        chunks.emplace_back(idx, idx + num, output);
     }
 
     return _merge_chunks(chunks, opts);
 }
 
+float VadModel::infer(VadState &state) {
+    auto cur = state._cur;
+
+    ScopedTimer timer(_infer_time);
+
+    float output = 0.0f;
+    try {
+        _session->Run(_run_options,
+                _input_node_names.data(), state._inputs[cur].data(), state._inputs[cur].size(),
+                _output_node_names.data(), state._outputs[cur].data(), state._outputs[cur].size());
+        output = state._output[0];
+        state._cur = 1 - cur;
+    } catch (const Ort::Exception &e) {
+        _errors.add();
+        output = -1.0f;
+    }
+
+    return output;
+}
+
 void VadModel::_init_threads(Ort::SessionOptions &opts,
         int intra_threads, int inter_threads) {
     opts.SetIntraOpNumThreads(intra_threads);
     opts.SetInterOpNumThreads(inter_threads);
-    opts.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
 }
 
 std::vector<SpeechChunk> VadModel::_merge_chunks(const std::vector<VadChunk> &chunks, const VadOptions &opts) const {
-    auto triggered = false;
     std::vector<SpeechChunk> speeches;
+    if (chunks.empty()) {
+        return speeches;
+    }
+
+    auto min_silence = to_samples(opts.min_silence, opts.sample_rate);
+    auto min_speech = to_samples(opts.min_speech, opts.sample_rate);
+    auto speech_pad = to_samples(opts.speech_pad, opts.sample_rate);
+    auto audio_end = chunks.back().end;
+
+    auto triggered = false;
     SpeechChunk cur;
-    SteadyTimePoint temp_end;
+    int64_t temp_end = -1;
     for (const auto &chunk : chunks) {
         if (chunk.prob >= opts.threshold) {
             // Speaking
-            temp_end = SteadyTimePoint{};
+            temp_end = -1;
         }
 
         if (chunk.prob >= opts.threshold - 0.15 && !triggered) {
@@ -103,36 +203,197 @@ std::vector<SpeechChunk> VadModel::_merge_chunks(const std::vector<VadChunk> &ch
 
         if (chunk.prob < opts.threshold && triggered) {
             // Silence
-            if (temp_end == SteadyTimePoint{}) {
+            if (temp_end < 0) {
                 temp_end = chunk.start;
             }
-            if (chunk.end - temp_end < opts.min_silence) {
+            if (chunk.end - temp_end < min_silence) {
                 continue;
             } else {
-                if (temp_end - cur.start > opts.min_speech) {
-                    cur.start -= opts.speech_pad;
-                    if (cur.start < SteadyTimePoint{}) {
-                        cur.start = SteadyTimePoint{};
-                    }
-                    cur.end = temp_end + opts.speech_pad;
-                    if (cur.end > chunks.back().end) {
-                        cur.end = chunks.back().end;
-                    }
+                if (temp_end - cur.start > min_speech) {
+                    cur.start = std::max<int64_t>(cur.start - speech_pad, 0);
+                    cur.end = std::min(temp_end + speech_pad, audio_end);
                     speeches.push_back(cur);
                 }
                 cur = SpeechChunk{};
-                temp_end = SteadyTimePoint{};
+                temp_end = -1;
                 triggered = false;
             }
         }
     }
 
-    if (cur.start > SteadyTimePoint{} && !chunks.empty() && chunks.back().end - cur.start > opts.min_speech) {
-        cur.end = chunks.back().end; // DO NOT add padding here.
+    if (triggered && audio_end - cur.start > min_speech) {
+        cur.start = std::max<int64_t>(cur.start - speech_pad, 0);
+        cur.end = audio_end; // DO NOT add padding here.
         speeches.push_back(cur);
     }
 
     return speeches;
 }
 
+VadSession::VadSession(VadModel &model, EventCallback callback, const VadOptions &opts) :
+    _model(model),
+    _callback(std::move(callback)),
+    _opts(opts),
+    _min_silence(to_samples(opts.min_silence, opts.sample_rate)),
+    _min_speech(to_samples(opts.min_speech, opts.sample_rate)),
+    _speech_pad(to_samples(opts.speech_pad, opts.sample_rate)),
+    _state(to_samples(opts.window_size, opts.sample_rate), opts.sample_rate),
+    _gate(opts.gate, opts.window_size) {
+    if (!_callback) {
+        throw Error("VadSession requires an event callback");
+    }
+}
+
+VadSession::~VadSession() {
+    if (_scheduler != nullptr) {
+        _scheduler->remove(*this);
+    }
+}
+
+void VadSession::feed(Span<const float> audio) {
+    if (_scheduler != nullptr) {
+        _pending.insert(_pending.end(), audio.begin(), audio.end());
+        return;
+    }
+
+    auto window = _state.window();
+    while (!audio.empty()) {
+        auto num = std::min(audio.size(), window.size() - _filled);
+        std::copy_n(audio.data(), num, window.data() + _filled);
+        _filled += num;
+        audio = audio.subspan(num);
+
+        if (_filled == window.size()) {
+            _filled = 0;
+            _update(_pass_gate(window) ? _model.infer(_state) : 0.0f, _state.window_size());
+        }
+    }
+}
+
+void VadSession::flush() {
+    // Windows not yet processed by the scheduler.
+    while (_ready()) {
+        auto window = _state.window();
+        std::copy_n(_next_window(), window.size(), window.data());
+        _pop_window();
+        _update(_pass_gate(window) ? _model.infer(_state) : 0.0f, _state.window_size());
+    }
+
+    // The last partial window is zero-padded, as VadModel::predict does.
+    auto window = _state.window();
+    auto tail = _filled;
+    if (_scheduler != nullptr) {
+        tail = _pending.size() - _pending_offset;
+        std::copy_n(_next_window(), tail, window.data());
+    }
+
+    if (tail > 0) {
+        std::fill(window.begin() + tail, window.end(), 0.0f);
+        _update(_pass_gate(window) ? _model.infer(_state) : 0.0f, static_cast<int64_t>(tail));
+    }
+
+    if (_triggered && _position - _speech_start > _min_speech) {
+        if (!_started) {
+            _emit(VadEventType::SPEECH_START, _position);
+        }
+
+        _emit(VadEventType::SPEECH_END, _position); // DO NOT add padding here.
+    }
+
+    reset();
+}
+
+void VadSession::reset() {
+    _filled = 0;
+    _pending.clear();
+    _pending_offset = 0;
+    _state.reset();
+    _gate.reset();
+    _position = 0;
+    _triggered = false;
+    _started = false;
+    _speech_start = 0;
+    _temp_end = -1;
+}
+
+void VadSession::skip(int64_t samples) {
+    // Audio fed before the gap, including the partial window.
+    auto unprocessed = _scheduler != nullptr ? _pending.size() - _pending_offset : _filled;
+    auto end = _position + static_cast<int64_t>(unprocessed);
+
+    flush();
+
+    _position = end + samples;
+}
+
+// Incremental version of VadModel::_merge_chunks.
+void VadSession::_update(float prob, int64_t samples) {
+    auto start = _position;
+    auto end = _position + samples;
+    _position = end;
+
+    if (prob >= _opts.threshold) {
+        // Speaking
+        _temp_end = -1;
+    }
+
+    if (prob >= _opts.threshold - 0.15 && !_triggered) {
+        _triggered = true;
+        _speech_start = start;
+        return;
+    }
+
+    if (!_triggered) {
+        return;
+    }
+
+    if (prob < _opts.threshold && _temp_end < 0) {
+        // Silence
+        _temp_end = start;
+    }
+
+    auto speech_end = (_temp_end < 0) ? end : _temp_end;
+    if (!_started && speech_end - _speech_start > _min_speech) {
+        _emit(VadEventType::SPEECH_START, end);
+    }
+
+    if (prob < _opts.threshold && end - _temp_end >= _min_silence) {
+        if (_started) {
+            _emit(VadEventType::SPEECH_END, std::min(_temp_end + _speech_pad, end));
+        }
+
+        _triggered = false;
+        _started = false;
+        _speech_start = 0;
+        _temp_end = -1;
+    }
+}
+
+bool VadSession::_pass_gate(Span<const float> window) {
+    return pass_gate(_gate, _state, window);
+}
+
+void VadSession::_pop_window() {
+    _pending_offset += _state.window_size();
+
+    // Reclaim consumed audio once it dominates the buffer, so that compaction is amortized O(1).
+    if (_pending_offset * 2 >= _pending.size()) {
+        _pending.erase(_pending.begin(), _pending.begin() + _pending_offset);
+        _pending_offset = 0;
+    }
+}
+
+void VadSession::_emit(VadEventType type, int64_t end) {
+    VadEvent event;
+    event.type = type;
+    event.chunk.start = std::max<int64_t>(_speech_start - _speech_pad, 0);
+    event.chunk.end = end;
+
+    if (type == VadEventType::SPEECH_START) {
+        _started = true;
+    }
+
+    _callback(event);
+}
+
 }
@@ -18,8 +18,16 @@
 #define SEWENEW_ASSISTANT_VAD_H
 
 #include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 #include "onnxruntime_cxx_api.h"
+#include "sw/assistant/metrics.h"
+#include "sw/assistant/onnx_runtime.h"
+#include "sw/assistant/span.h"
+#include "sw/assistant/vad_gate.h"
 
 namespace sw::assistant {
 
@@ -33,31 +41,126 @@ struct VadOptions {
     std::chrono::milliseconds window_size = std::chrono::milliseconds(64);
 
     float threshold = 0.5f;
-};
 
-using SteadyTimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+    // Windows skipped by the pre-gate are reported with probability 0.
+    VadGateOptions gate;
+};
 
+// Chunks are indexed by samples, i.e. [start, end) of the audio.
 struct VadChunk {
-    VadChunk(const SteadyTimePoint &s, const SteadyTimePoint &e, float p) :
-        start(s), end(e), prob(p) {}
+    VadChunk(int64_t s, int64_t e, float p) : start(s), end(e), prob(p) {}
 
-    SteadyTimePoint start;
-    SteadyTimePoint end;
+    int64_t start = 0;
+    int64_t end = 0;
     float prob = 0.0f;
 };
 
 struct SpeechChunk {
-    SteadyTimePoint start = SteadyTimePoint{std::chrono::milliseconds(-1)};
-    SteadyTimePoint end;
+    int64_t start = 0;
+    int64_t end = 0;
+};
+
+// Non-owning views of `audio`, one for each speech chunk returned by VadModel::predict.
+std::vector<Span<const float>> speech_spans(Span<const float> audio, const std::vector<SpeechChunk> &chunks);
+
+// Per-stream buffers of the Silero model: input window, sample rate, output and LSTM state.
+// Tensors are bound to these buffers once at construction, and h/c are ping-ponged between
+// 2 buffers, i.e. outputs of one window become inputs of the next, so that running a window
+// neither allocates tensors nor copies state.
+class VadState {
+public:
+    static constexpr int64_t HC_SIZE = 2 * 1 * 64;
+
+    VadState(int64_t window_size, int64_t sample_rate);
+
+    VadState(const VadState &) = delete;
+    VadState& operator=(const VadState &) = delete;
+
+    // Tensors point to buffers owned by vectors, which stay in place when moved.
+    VadState(VadState &&) = default;
+    VadState& operator=(VadState &&) = default;
+
+    // Input window, which should be filled before calling VadModel::infer.
+    Span<float> window() {
+        return Span<float>(_input.data(), _input.size());
+    }
+
+    int64_t window_size() const {
+        return static_cast<int64_t>(_input.size());
+    }
+
+    int64_t sample_rate() const {
+        return _sample_rate[0];
+    }
+
+    // Current LSTM state, i.e. the state after the last window.
+    Span<float> h() {
+        return Span<float>(_h[_cur].data(), _h[_cur].size());
+    }
+
+    Span<float> c() {
+        return Span<float>(_c[_cur].data(), _c[_cur].size());
+    }
+
+    void reset();
+
+private:
+    friend class VadModel;
+
+    std::vector<float> _input;
+
+    // Scalars are also kept in vectors, so that tensors remain valid after move.
+    std::vector<int64_t> _sample_rate;
+
+    std::vector<float> _output;
+
+    std::vector<float> _h[2];
+
+    std::vector<float> _c[2];
+
+    // Index of buffers holding the current state.
+    int _cur = 0;
+
+    // _inputs[i] takes _h[i] and _c[i] as inputs, and _outputs[i] writes to _h[1 - i] and _c[1 - i].
+    std::vector<Ort::Value> _inputs[2];
+
+    std::vector<Ort::Value> _outputs[2];
+};
+
+struct VadModelOptions {
+    // Run the process-wide session of the model on OnnxRuntime's global thread pools.
+    // Otherwise, the model gets its own session with private thread pools.
+    bool shared = true;
+
+    // Size of private thread pools, i.e. only used if `shared` is false.
+    int intra_threads = 1;
+    int inter_threads = 1;
+
+    // Optimized model cache and execution providers. Quantized models, e.g. int8 Silero,
+    // are loaded the same way, since they take the same inputs and outputs.
+    OnnxSessionOptions session;
 };
 
+class VadScheduler;
+
+// A lightweight handle of the model. By default, all handles of the same model share one
+// session, i.e. creating one per stream costs neither threads nor another copy of the graph.
+// Per-stream state lives in VadState or VadSession. It's thread-safe.
 class VadModel {
 public:
-    explicit VadModel(const std::string &model_path, int intra_threads = 1, int inter_threads = 1);
+    explicit VadModel(const std::string &model_path, const VadModelOptions &opts = {});
+
+    // If audio is not a multiple of window size, the last window is zero-padded,
+    // and chunks never go beyond the end of audio.
+    std::vector<SpeechChunk> predict(Span<const float> audio, const VadOptions &opts = {});
 
-    std::vector<SpeechChunk> predict(std::vector<float> &data, const VadOptions &opts = {});
+    // Run the model on `state.window()`, and update state in place.
+    // Returns speech probability of the window, or -1.0 on failure.
+    float infer(VadState &state);
 
 private:
+    friend class VadScheduler;
+
     void _init_threads(Ort::SessionOptions &opts, int intra_threads, int inter_threads);
 
     std::vector<SpeechChunk> _merge_chunks(const std::vector<VadChunk> &chunks, const VadOptions &opts) const;
@@ -66,10 +169,121 @@ private:
 
     std::vector<const char *> _output_node_names = {"output", "hn", "cn"};
 
-    Ort::Env _env;
-    Ort::SessionOptions _session_options;
     std::shared_ptr<Ort::Session> _session;
-    Ort::MemoryInfo _memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeCPU);
+    Ort::RunOptions _run_options{nullptr};
+
+    // Time of Session::Run per window, and number of failed runs.
+    Histogram &_infer_time;
+    Counter &_errors;
+};
+
+enum class VadEventType {
+    SPEECH_START = 0,
+    SPEECH_END
+};
+
+struct VadEvent {
+    VadEventType type;
+
+    // For SPEECH_START, `chunk.end` is the end of audio that has been processed so far.
+    SpeechChunk chunk;
+};
+
+// Streaming VAD for a single audio stream. Audio can be fed in pieces of any size,
+// and LSTM state is kept across calls. Events are raised as soon as
+// `VadOptions::min_speech` and `VadOptions::min_silence` are resolved.
+// If the session is added to a VadScheduler, `feed` only buffers audio, and windows
+// are processed in batch by VadScheduler::run.
+// NOTE: it's NOT thread-safe.
+class VadSession {
+public:
+    using EventCallback = std::function<void (const VadEvent &)>;
+
+    VadSession(VadModel &model, EventCallback callback, const VadOptions &opts = {});
+
+    VadSession(const VadSession &) = delete;
+    VadSession& operator=(const VadSession &) = delete;
+
+    VadSession(VadSession &&) = delete;
+    VadSession& operator=(VadSession &&) = delete;
+
+    ~VadSession();
+
+    void feed(Span<const float> audio);
+
+    // End of stream. The last partial window is zero-padded and processed, and if there's
+    // ongoing speech, SPEECH_END is raised at the end of audio without padding.
+    void flush();
+
+    void reset();
+
+    // Audio of `samples` is missing, e.g. dropped by a full queue. Audio before the gap is flushed,
+    // and the session restarts after the gap, so that positions of later events match the stream.
+    void skip(int64_t samples);
+
+    // Number of samples that have been processed, i.e. partial window is excluded.
+    int64_t position() const {
+        return _position;
+    }
+
+private:
+    friend class VadScheduler;
+
+    // `samples` of the window are audio, and the rest, if any, is zero padding.
+    void _update(float prob, int64_t samples);
+
+    // Returns false if the window is skipped by the pre-gate.
+    bool _pass_gate(Span<const float> window);
+
+    void _emit(VadEventType type, int64_t end);
+
+    // Scheduled mode only.
+    bool _ready() const {
+        return _pending.size() - _pending_offset >= static_cast<std::size_t>(_state.window_size());
+    }
+
+    const float* _next_window() const {
+        return _pending.data() + _pending_offset;
+    }
+
+    void _pop_window();
+
+    VadModel &_model;
+
+    VadScheduler *_scheduler = nullptr;
+
+    // Audio buffered in scheduled mode, which has not been processed yet.
+    std::vector<float> _pending;
+
+    std::size_t _pending_offset = 0;
+
+    EventCallback _callback;
+
+    VadOptions _opts;
+
+    // Durations of VadOptions in samples.
+    int64_t _min_silence = 0;
+
+    int64_t _min_speech = 0;
+
+    int64_t _speech_pad = 0;
+
+    std::size_t _filled = 0;
+
+    VadState _state;
+
+    VadGate _gate;
+
+    int64_t _position = 0;
+
+    bool _triggered = false;
+
+    bool _started = false;
+
+    int64_t _speech_start = 0;
+
+    // Start of silence during speech, or -1 if there's none.
+    int64_t _temp_end = -1;
 };
 
 }
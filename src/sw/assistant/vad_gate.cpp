@@ -0,0 +1,212 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/vad_gate.h"
+#include <algorithm>
+#include <cmath>
+#include "sw/assistant/errors.h"
+#include "sw/assistant/simd.h"
+
+namespace {
+
+using namespace sw::assistant;
+
+// Accumulates energy of x[0, size), and sign changes between x[idx - 1] and x[idx].
+// Sign is taken from the sign bit, so that SIMD kernels compare bits only.
+using FeaturesKernel = void (*)(const float *x, std::size_t size, float &energy, uint32_t &crossings);
+
+void features_tail(const float *x, std::size_t idx, std::size_t size, float &energy, uint32_t &crossings) {
+    for (; idx < size; ++idx) {
+        energy += x[idx] * x[idx];
+        crossings += (std::signbit(x[idx]) != std::signbit(x[idx - 1])) ? 1 : 0;
+    }
+}
+
+#if defined(SW_ASSISTANT_AVX2)
+
+SW_ASSISTANT_TARGET_AVX2
+void features_avx2(const float *x, std::size_t size, float &energy, uint32_t &crossings) {
+    auto acc = _mm256_setzero_ps();
+    auto cnt = _mm256_setzero_si256();
+    std::size_t idx = 1;
+    for (; idx + 8 <= size; idx += 8) {
+        auto cur = _mm256_loadu_ps(x + idx);
+        auto prev = _mm256_loadu_ps(x + idx - 1);
+        acc = _mm256_fmadd_ps(cur, cur, acc);
+        cnt = _mm256_add_epi32(cnt, _mm256_srli_epi32(_mm256_castps_si256(_mm256_xor_ps(cur, prev)), 31));
+    }
+
+    auto sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    auto num = _mm_add_epi32(_mm256_castsi256_si128(cnt), _mm256_extracti128_si256(cnt, 1));
+    num = _mm_add_epi32(num, _mm_shuffle_epi32(num, _MM_SHUFFLE(1, 0, 3, 2)));
+    num = _mm_add_epi32(num, _mm_shuffle_epi32(num, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    energy = _mm_cvtss_f32(sum) + x[0] * x[0];
+    crossings = static_cast<uint32_t>(_mm_cvtsi128_si32(num));
+    features_tail(x, idx, size, energy, crossings);
+}
+
+#endif
+
+#if defined(SW_ASSISTANT_SSE2)
+
+void features_vec(const float *x, std::size_t size, float &energy, uint32_t &crossings) {
+    auto acc = _mm_setzero_ps();
+    auto cnt = _mm_setzero_si128();
+    std::size_t idx = 1;
+    for (; idx + 4 <= size; idx += 4) {
+        auto cur = _mm_loadu_ps(x + idx);
+        auto prev = _mm_loadu_ps(x + idx - 1);
+        acc = _mm_add_ps(acc, _mm_mul_ps(cur, cur));
+        cnt = _mm_add_epi32(cnt, _mm_srli_epi32(_mm_castps_si128(_mm_xor_ps(cur, prev)), 31));
+    }
+
+    auto sum = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    auto num = _mm_add_epi32(cnt, _mm_shuffle_epi32(cnt, _MM_SHUFFLE(1, 0, 3, 2)));
+    num = _mm_add_epi32(num, _mm_shuffle_epi32(num, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    energy = _mm_cvtss_f32(sum) + x[0] * x[0];
+    crossings = static_cast<uint32_t>(_mm_cvtsi128_si32(num));
+    features_tail(x, idx, size, energy, crossings);
+}
+
+#elif defined(SW_ASSISTANT_NEON)
+
+void features_vec(const float *x, std::size_t size, float &energy, uint32_t &crossings) {
+    auto acc = vdupq_n_f32(0.0f);
+    auto cnt = vdupq_n_u32(0);
+    std::size_t idx = 1;
+    for (; idx + 4 <= size; idx += 4) {
+        auto cur = vld1q_f32(x + idx);
+        auto prev = vld1q_f32(x + idx - 1);
+        acc = vfmaq_f32(acc, cur, cur);
+        cnt = vaddq_u32(cnt, vshrq_n_u32(veorq_u32(vreinterpretq_u32_f32(cur), vreinterpretq_u32_f32(prev)), 31));
+    }
+
+    energy = vaddvq_f32(acc) + x[0] * x[0];
+    crossings = vaddvq_u32(cnt);
+    features_tail(x, idx, size, energy, crossings);
+}
+
+#else
+
+void features_vec(const float *x, std::size_t size, float &energy, uint32_t &crossings) {
+    energy = x[0] * x[0];
+    crossings = 0;
+    features_tail(x, 1, size, energy, crossings);
+}
+
+#endif
+
+FeaturesKernel features_kernel() {
+#if defined(SW_ASSISTANT_AVX2)
+    static const FeaturesKernel kernel = simd::has_avx2() ? features_avx2 : features_vec;
+    return kernel;
+#else
+    return features_vec;
+#endif
+}
+
+int64_t to_windows(std::chrono::milliseconds duration, std::chrono::milliseconds window_size) {
+    return (duration.count() + window_size.count() - 1) / window_size.count();
+}
+
+}
+
+namespace sw::assistant {
+
+WindowFeatures window_features(Span<const float> window) {
+    WindowFeatures features;
+    if (window.empty()) {
+        return features;
+    }
+
+    float energy = 0.0f;
+    uint32_t crossings = 0;
+    features_kernel()(window.data(), window.size(), energy, crossings);
+
+    features.rms = std::sqrt(energy / window.size());
+    if (window.size() > 1) {
+        features.zcr = static_cast<float>(crossings) / (window.size() - 1);
+    }
+
+    return features;
+}
+
+VadGate::VadGate(const VadGateOptions &opts, std::chrono::milliseconds window_size) :
+    _opts(opts),
+    _skipped_metric(MetricsRegistry::instance().counter("assistant_vad_gate_skipped_total",
+                "Number of VAD windows skipped by pre-gate")) {
+    if (window_size.count() <= 0) {
+        throw Error("invalid VAD window size");
+    }
+
+    if (_opts.noise_adapt.count() > 0) {
+        _adapt_rate = std::min(1.0f, static_cast<float>(window_size.count()) / _opts.noise_adapt.count());
+    } else {
+        _adapt_rate = 1.0f;
+    }
+
+    _hangover_windows = to_windows(_opts.hangover, window_size);
+    _reset_windows = std::max<int64_t>(1, to_windows(_opts.reset_after, window_size));
+
+    reset();
+}
+
+GateResult VadGate::check(Span<const float> window) {
+    auto features = window_features(window);
+    auto db = 20.0f * std::log10(features.rms + 1e-10f);
+
+    auto margin = features.zcr > _opts.max_zcr ? 2.0f * _opts.margin_db : _opts.margin_db;
+    auto active = db >= _noise_db + margin;
+
+    // Noise floor starts from `min_noise_db`, and rises slowly. While windows look like
+    // speech, it rises even slower, so that a persistent louder noise is absorbed eventually.
+    if (db < _noise_db) {
+        _noise_db = std::max(db, _opts.min_noise_db);
+    } else {
+        _noise_db += (db - _noise_db) * (active ? _adapt_rate / 8 : _adapt_rate);
+    }
+
+    if (active) {
+        _hangover = _hangover_windows;
+    } else if (_hangover > 0) {
+        --_hangover;
+        active = true;
+    }
+
+    if (!active) {
+        ++_skipped;
+        _skipped_metric.add();
+        return GateResult::SKIP;
+    }
+
+    auto result = _skipped >= _reset_windows ? GateResult::RESET_AND_RUN : GateResult::RUN;
+    _skipped = 0;
+
+    return result;
+}
+
+void VadGate::reset() {
+    _noise_db = _opts.min_noise_db;
+    _hangover = 0;
+    _skipped = 0;
+}
+
+}
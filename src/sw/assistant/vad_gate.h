@@ -0,0 +1,108 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_VAD_GATE_H
+#define SEWENEW_ASSISTANT_VAD_GATE_H
+
+#include <chrono>
+#include <cstdint>
+#include "sw/assistant/metrics.h"
+#include "sw/assistant/span.h"
+
+namespace sw::assistant {
+
+// Pre-gate of VAD model. Windows whose energy is close to the noise floor are clearly
+// not speech, and skip the model, i.e. they're reported as silence.
+struct VadGateOptions {
+    bool enabled = false;
+
+    // A window might be speech, if its energy is at least this much above the noise floor.
+    float margin_db = 6.0f;
+
+    // Noise floor never goes below this, so that digital silence is always skipped.
+    float min_noise_db = -60.0f;
+
+    // Windows with zero-crossing rate above this, e.g. hiss, need twice the margin.
+    float max_zcr = 0.35f;
+
+    // Keep running the model for a while after energy drops, so that weak endings are not cut.
+    std::chrono::milliseconds hangover = std::chrono::milliseconds(320);
+
+    // Time constant of noise floor rising. It falls immediately.
+    std::chrono::milliseconds noise_adapt = std::chrono::milliseconds(2000);
+
+    // LSTM state is reset, once this much audio has been skipped, since the state
+    // no longer describes the audio that follows.
+    std::chrono::milliseconds reset_after = std::chrono::milliseconds(1000);
+};
+
+struct WindowFeatures {
+    float rms = 0.0f;
+
+    // Fraction of adjacent samples with different signs.
+    float zcr = 0.0f;
+};
+
+// Vectorized with AVX2/SSE2/NEON.
+WindowFeatures window_features(Span<const float> window);
+
+enum class GateResult {
+    SKIP = 0,
+    RUN,
+    // Reset LSTM state, and then run the model.
+    RESET_AND_RUN
+};
+
+// Per-stream gate state.
+// NOTE: it's NOT thread-safe.
+class VadGate {
+public:
+    VadGate(const VadGateOptions &opts, std::chrono::milliseconds window_size);
+
+    bool enabled() const {
+        return _opts.enabled;
+    }
+
+    GateResult check(Span<const float> window);
+
+    void reset();
+
+    float noise_floor_db() const {
+        return _noise_db;
+    }
+
+private:
+    VadGateOptions _opts;
+
+    // Per-window factor of noise floor rising.
+    float _adapt_rate = 0.0f;
+
+    int64_t _hangover_windows = 0;
+
+    int64_t _reset_windows = 0;
+
+    float _noise_db = 0.0f;
+
+    int64_t _hangover = 0;
+
+    int64_t _skipped = 0;
+
+    Counter &_skipped_metric;
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_VAD_GATE_H
@@ -0,0 +1,212 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/vad_scheduler.h"
+#include <algorithm>
+#include "sw/assistant/errors.h"
+
+namespace sw::assistant {
+
+namespace {
+
+// Per-stream hidden size of the Silero LSTM, i.e. state is [2, N, HIDDEN_SIZE].
+constexpr std::size_t HIDDEN_SIZE = 64;
+
+constexpr std::size_t NUM_LAYERS = 2;
+
+}
+
+VadScheduler::VadScheduler(VadModel &model, std::size_t max_batch) :
+    _model(model),
+    _max_batch(max_batch),
+    _batch_time(MetricsRegistry::instance().histogram("assistant_vad_batch_seconds",
+                "Time of batched VAD inference")),
+    _batch_sizes(MetricsRegistry::instance().histogram("assistant_vad_batch_size",
+                "Number of windows per batched VAD inference", {}, Histogram::exponential(1, 2, 8))) {
+    if (_max_batch == 0) {
+        throw Error("max batch size should be greater than 0");
+    }
+
+    _batch.reserve(_max_batch);
+    _sample_rate.resize(1);
+    _h.resize(NUM_LAYERS * _max_batch * HIDDEN_SIZE);
+    _c.resize(_h.size());
+    _hn.resize(_h.size());
+    _cn.resize(_h.size());
+    _output.resize(_max_batch);
+    _batch_tensors.resize(_max_batch + 1);
+}
+
+VadScheduler::~VadScheduler() {
+    for (auto *session : _sessions) {
+        session->_scheduler = nullptr;
+    }
+}
+
+void VadScheduler::add(VadSession &session) {
+    if (session._scheduler == this) {
+        return;
+    }
+
+    if (session._scheduler != nullptr) {
+        throw Error("VAD session has been added to another scheduler");
+    }
+
+    auto window_size = session._state.window_size();
+    auto sample_rate = session._state.sample_rate();
+    if (_sessions.empty()) {
+        _window_size = window_size;
+        _sample_rate[0] = sample_rate;
+        _input.resize(_max_batch * _window_size);
+        // Tensors are bound to the input buffer, which might have been reallocated.
+        std::fill(_batch_tensors.begin(), _batch_tensors.end(), nullptr);
+    } else if (window_size != _window_size || sample_rate != _sample_rate[0]) {
+        throw Error("VAD sessions in a scheduler should have the same window size and sample rate");
+    }
+
+    // Audio buffered before joining the scheduler is processed by the scheduler.
+    auto window = session._state.window();
+    session._pending.insert(session._pending.begin(), window.begin(), window.begin() + session._filled);
+    session._filled = 0;
+
+    session._scheduler = this;
+    _sessions.push_back(&session);
+}
+
+void VadScheduler::remove(VadSession &session) {
+    auto iter = std::find(_sessions.begin(), _sessions.end(), &session);
+    if (iter == _sessions.end()) {
+        return;
+    }
+
+    _sessions.erase(iter);
+    session._scheduler = nullptr;
+}
+
+std::size_t VadScheduler::run() {
+    std::size_t windows = 0;
+    while (true) {
+        _batch.clear();
+        for (auto *session : _sessions) {
+            // Windows skipped by the pre-gate never get into a batch.
+            while (session->_ready() &&
+                    !session->_pass_gate(Span<const float>(session->_next_window(), _window_size))) {
+                session->_pop_window();
+                session->_update(0.0f, _window_size);
+                ++windows;
+            }
+
+            if (session->_ready()) {
+                _batch.push_back(session);
+                if (_batch.size() == _max_batch) {
+                    break;
+                }
+            }
+        }
+
+        if (_batch.empty()) {
+            break;
+        }
+
+        _run_batch();
+
+        windows += _batch.size();
+    }
+
+    return windows;
+}
+
+VadScheduler::BatchTensors& VadScheduler::_tensors(std::size_t batch_size) {
+    auto &tensors = _batch_tensors[batch_size];
+    if (tensors) {
+        return *tensors;
+    }
+
+    auto memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeCPU);
+
+    const int64_t batch = static_cast<int64_t>(batch_size);
+    const int64_t input_node_dims[2] = {batch, _window_size};
+    const int64_t sr_node_dims[1] = {1};
+    const int64_t hc_node_dims[3] = {NUM_LAYERS, batch, HIDDEN_SIZE};
+    const int64_t output_node_dims[2] = {batch, 1};
+    auto hc_size = NUM_LAYERS * batch_size * HIDDEN_SIZE;
+
+    tensors = std::make_unique<BatchTensors>();
+    tensors->inputs.reserve(4);
+    tensors->inputs.push_back(Ort::Value::CreateTensor<float>(memory_info, _input.data(), batch_size * _window_size, input_node_dims, 2));
+    tensors->inputs.push_back(Ort::Value::CreateTensor<int64_t>(memory_info, _sample_rate.data(), 1, sr_node_dims, 1));
+    tensors->inputs.push_back(Ort::Value::CreateTensor<float>(memory_info, _h.data(), hc_size, hc_node_dims, 3));
+    tensors->inputs.push_back(Ort::Value::CreateTensor<float>(memory_info, _c.data(), hc_size, hc_node_dims, 3));
+
+    tensors->outputs.reserve(3);
+    tensors->outputs.push_back(Ort::Value::CreateTensor<float>(memory_info, _output.data(), batch_size, output_node_dims, 2));
+    tensors->outputs.push_back(Ort::Value::CreateTensor<float>(memory_info, _hn.data(), hc_size, hc_node_dims, 3));
+    tensors->outputs.push_back(Ort::Value::CreateTensor<float>(memory_info, _cn.data(), hc_size, hc_node_dims, 3));
+
+    return *tensors;
+}
+
+void VadScheduler::_run_batch() {
+    auto batch_size = _batch.size();
+
+    // Gather: input[i] = window of stream i, h[l][i] = layer l of stream i's state.
+    for (std::size_t idx = 0; idx < batch_size; ++idx) {
+        auto *session = _batch[idx];
+        std::copy_n(session->_next_window(), _window_size, _input.data() + idx * _window_size);
+
+        auto h = session->_state.h();
+        auto c = session->_state.c();
+        for (std::size_t layer = 0; layer < NUM_LAYERS; ++layer) {
+            auto offset = (layer * batch_size + idx) * HIDDEN_SIZE;
+            std::copy_n(h.data() + layer * HIDDEN_SIZE, HIDDEN_SIZE, _h.data() + offset);
+            std::copy_n(c.data() + layer * HIDDEN_SIZE, HIDDEN_SIZE, _c.data() + offset);
+        }
+    }
+
+    auto &tensors = _tensors(batch_size);
+    auto ok = true;
+    {
+        ScopedTimer timer(_batch_time);
+        try {
+            _model._session->Run(_model._run_options,
+                    _model._input_node_names.data(), tensors.inputs.data(), tensors.inputs.size(),
+                    _model._output_node_names.data(), tensors.outputs.data(), tensors.outputs.size());
+        } catch (const Ort::Exception &e) {
+            _model._errors.add();
+            ok = false;
+        }
+    }
+    _batch_sizes.observe(static_cast<double>(batch_size));
+
+    // Scatter: on failure, keep each stream's state, and report -1.0 as VadModel::infer does.
+    for (std::size_t idx = 0; idx < batch_size; ++idx) {
+        auto *session = _batch[idx];
+        if (ok) {
+            auto h = session->_state.h();
+            auto c = session->_state.c();
+            for (std::size_t layer = 0; layer < NUM_LAYERS; ++layer) {
+                auto offset = (layer * batch_size + idx) * HIDDEN_SIZE;
+                std::copy_n(_hn.data() + offset, HIDDEN_SIZE, h.data() + layer * HIDDEN_SIZE);
+                std::copy_n(_cn.data() + offset, HIDDEN_SIZE, c.data() + layer * HIDDEN_SIZE);
+            }
+        }
+
+        session->_pop_window();
+        session->_update(ok ? _output[idx] : -1.0f, _window_size);
+    }
+}
+
+}
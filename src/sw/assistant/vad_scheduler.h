@@ -0,0 +1,98 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_VAD_SCHEDULER_H
+#define SEWENEW_ASSISTANT_VAD_SCHEDULER_H
+
+#include <memory>
+#include <vector>
+#include "onnxruntime_cxx_api.h"
+#include "sw/assistant/metrics.h"
+#include "sw/assistant/vad.h"
+
+namespace sw::assistant {
+
+// Runs VAD for many streams in batch. Each run gathers the next window from up to
+// `max_batch` sessions into one [N, window] input with [2, N, 64] state, calls the model
+// once, and scatters probabilities and LSTM state back to each session.
+// All sessions should have the same window size and sample rate.
+// NOTE: it's NOT thread-safe, sessions should be fed on the thread calling `run`.
+class VadScheduler {
+public:
+    explicit VadScheduler(VadModel &model, std::size_t max_batch = 32);
+
+    VadScheduler(const VadScheduler &) = delete;
+    VadScheduler& operator=(const VadScheduler &) = delete;
+
+    VadScheduler(VadScheduler &&) = delete;
+    VadScheduler& operator=(VadScheduler &&) = delete;
+
+    ~VadScheduler();
+
+    void add(VadSession &session);
+
+    void remove(VadSession &session);
+
+    // Process windows until no session has a complete window buffered.
+    // Returns the number of windows processed.
+    std::size_t run();
+
+private:
+    // Tensors for a given batch size, bound to the shared buffers below.
+    struct BatchTensors {
+        std::vector<Ort::Value> inputs;
+        std::vector<Ort::Value> outputs;
+    };
+
+    BatchTensors& _tensors(std::size_t batch_size);
+
+    void _run_batch();
+
+    VadModel &_model;
+
+    std::size_t _max_batch = 0;
+
+    int64_t _window_size = 0;
+
+    std::vector<VadSession *> _sessions;
+
+    std::vector<VadSession *> _batch;
+
+    std::vector<float> _input;
+
+    std::vector<int64_t> _sample_rate;
+
+    std::vector<float> _h;
+
+    std::vector<float> _c;
+
+    std::vector<float> _output;
+
+    std::vector<float> _hn;
+
+    std::vector<float> _cn;
+
+    // Indexed by batch size, created on first use.
+    std::vector<std::unique_ptr<BatchTensors>> _batch_tensors;
+
+    Histogram &_batch_time;
+
+    Histogram &_batch_sizes;
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_VAD_SCHEDULER_H
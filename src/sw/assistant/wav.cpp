@@ -0,0 +1,452 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/wav.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sw/assistant/resampler.h"
+
+namespace sw::assistant {
+
+namespace {
+
+constexpr uint16_t WAVE_FORMAT_PCM = 0x0001;
+constexpr uint16_t WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+// Size of RIFF chunk header, i.e. id and size.
+constexpr std::size_t CHUNK_HEADER_SIZE = 8;
+
+Error sys_error(const std::string &msg) {
+    return Error(msg + ": " + std::strerror(errno));
+}
+
+// WAV files are little endian.
+uint16_t read_u16(const uint8_t *data) {
+    return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t read_u32(const uint8_t *data) {
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+        (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+bool is_id(const uint8_t *data, const char *id) {
+    return std::memcmp(data, id, 4) == 0;
+}
+
+}
+
+WavWriter::WavWriter(const WavWriterOptions &opts) : _opts(opts) {
+    _buffer.reserve(_opts.buffer_size);
+}
+
+WavWriter::~WavWriter() {
+    try {
+        close();
+    } catch (const Error &) {
+        // Avoid throwing from destructor.
+    }
+}
+
+void WavWriter::write(const std::string &path, const WavOptions &options, const std::vector<uint8_t> &data) {
+    open(path, options);
+    append(data.data(), data.size());
+    close();
+}
+
+void WavWriter::open(const std::string &path, const WavOptions &options) {
+    if (is_open()) {
+        throw Error("WAV file is already open: " + _path);
+    }
+
+    if (options.channels == 0 || options.sample_per_second == 0) {
+        throw Error("invalid channels or sample rate of WAV file");
+    }
+
+    auto bits = SDL_AUDIO_BITSIZE(options.format);
+    // 8 bits WAV is unsigned, and WAV is little endian.
+    if (bits == 0 || bits % 8 != 0 || options.format == AUDIO_S8 || SDL_AUDIO_ISBIGENDIAN(options.format)) {
+        throw Error("unsupported format of WAV file: " + std::to_string(options.format));
+    }
+
+    WavHeader header;
+    header.audio_format = SDL_AUDIO_ISFLOAT(options.format) ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+    header.num_channels = options.channels;
+    header.sample_rate = options.sample_per_second;
+    header.block_align = static_cast<uint16_t>(options.channels * (bits / 8));
+    header.bytes_rate = options.sample_per_second * header.block_align;
+    header.bits_per_sample = static_cast<uint16_t>(bits);
+
+    // RIFF chunk size, i.e. file size - 8, is a 32 bits integer.
+    uint64_t max_data_size = UINT32_MAX - (sizeof(WavHeader) - CHUNK_HEADER_SIZE);
+    if (_opts.max_file_size > 0) {
+        auto limit = _opts.max_file_size > sizeof(WavHeader) ? _opts.max_file_size - sizeof(WavHeader) : 0;
+        max_data_size = std::min<uint64_t>(max_data_size, limit);
+    }
+    if (_opts.max_file_duration.count() > 0) {
+        auto limit = static_cast<uint64_t>(header.bytes_rate) * _opts.max_file_duration.count() / 1000;
+        max_data_size = std::min<uint64_t>(max_data_size, limit);
+    }
+    // Split files on frame boundary.
+    max_data_size = max_data_size / header.block_align * header.block_align;
+    if (max_data_size == 0) {
+        throw Error("max_file_size or max_file_duration is too small to hold a frame");
+    }
+
+    _header = header;
+    _max_data_size = max_data_size;
+    _base_path = path;
+    _index = 0;
+
+    _open_file();
+}
+
+void WavWriter::append(const uint8_t *data, std::size_t size) {
+    if (!is_open()) {
+        throw Error("WAV file is not open");
+    }
+
+    while (size > 0) {
+        if (_data_size == _max_data_size) {
+            _rotate();
+        }
+
+        auto num = static_cast<std::size_t>(std::min<uint64_t>(size, _max_data_size - _data_size));
+        _write(data, num);
+        _data_size += num;
+        data += num;
+        size -= num;
+    }
+}
+
+void WavWriter::flush() {
+    if (!is_open()) {
+        return;
+    }
+
+    _flush_buffer();
+    _patch_header();
+}
+
+void WavWriter::close() {
+    if (!is_open()) {
+        return;
+    }
+
+    _close_file();
+}
+
+void WavWriter::_open_file() {
+    _path = (_index == 0) ? _base_path : _rotated_path();
+
+    _fd = ::open(_path.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        throw sys_error("failed to open " + _path);
+    }
+
+    _data_size = 0;
+
+    // Sizes are 0 until the header is patched, and readers take the data chunk as
+    // extending to the end of file, e.g. if the process crashed before that.
+    _header.chunk_size = 0;
+    _header.data_chunk_size = 0;
+    _write_all(reinterpret_cast<const uint8_t *>(&_header), sizeof(_header));
+}
+
+void WavWriter::_close_file() {
+    try {
+        _flush_buffer();
+        _patch_header();
+    } catch (...) {
+        ::close(_fd);
+        _fd = -1;
+        _buffer.clear();
+        throw;
+    }
+
+    auto ret = ::close(_fd);
+    _fd = -1;
+    if (ret != 0) {
+        throw sys_error("failed to close " + _path);
+    }
+}
+
+void WavWriter::_rotate() {
+    _close_file();
+
+    ++_index;
+
+    _open_file();
+}
+
+void WavWriter::_write(const uint8_t *data, std::size_t size) {
+    if (_buffer.size() + size > _opts.buffer_size) {
+        _flush_buffer();
+    }
+
+    if (size >= _opts.buffer_size) {
+        // Large chunk is written directly, instead of being copied into buffer.
+        _write_all(data, size);
+    } else {
+        _buffer.insert(_buffer.end(), data, data + size);
+    }
+}
+
+void WavWriter::_write_all(const uint8_t *data, std::size_t size) {
+    while (size > 0) {
+        auto num = ::write(_fd, data, size);
+        if (num < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw sys_error("failed to write " + _path);
+        }
+
+        data += num;
+        size -= static_cast<std::size_t>(num);
+    }
+}
+
+void WavWriter::_flush_buffer() {
+    if (_buffer.empty()) {
+        return;
+    }
+
+    _write_all(_buffer.data(), _buffer.size());
+    _buffer.clear();
+}
+
+void WavWriter::_patch_header() {
+    _header.data_chunk_size = static_cast<uint32_t>(_data_size);
+    _header.chunk_size = static_cast<uint32_t>(_data_size + sizeof(WavHeader) - CHUNK_HEADER_SIZE);
+
+    const auto *header = reinterpret_cast<const uint8_t *>(&_header);
+    std::size_t offset = 0;
+    while (offset < sizeof(_header)) {
+        auto num = ::pwrite(_fd, header + offset, sizeof(_header) - offset, static_cast<off_t>(offset));
+        if (num < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw sys_error("failed to write header of " + _path);
+        }
+        offset += static_cast<std::size_t>(num);
+    }
+}
+
+std::string WavWriter::_rotated_path() const {
+    auto suffix = "." + std::to_string(_index);
+
+    auto slash = _base_path.find_last_of('/');
+    auto dot = _base_path.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return _base_path + suffix;
+    }
+
+    return _base_path.substr(0, dot) + suffix + _base_path.substr(dot);
+}
+
+WavReader::WavReader(const std::string &path) {
+    auto fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw sys_error("failed to open " + path);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        auto err = sys_error("failed to stat " + path);
+        ::close(fd);
+        throw err;
+    }
+
+    _map_size = static_cast<std::size_t>(st.st_size);
+    if (_map_size < CHUNK_HEADER_SIZE + 4) {
+        ::close(fd);
+        throw Error("not a WAV file: " + path);
+    }
+
+    auto *map = ::mmap(nullptr, _map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive.
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        throw sys_error("failed to mmap " + path);
+    }
+
+    _map = static_cast<const uint8_t *>(map);
+
+    // Samples are normally read from the beginning to the end.
+    ::madvise(map, _map_size, MADV_SEQUENTIAL);
+
+    try {
+        _parse(path);
+    } catch (...) {
+        _close();
+        throw;
+    }
+}
+
+WavReader::WavReader(WavReader &&other) noexcept :
+    _map(std::exchange(other._map, nullptr)),
+    _map_size(std::exchange(other._map_size, 0)),
+    _data(std::exchange(other._data, {})),
+    _options(other._options),
+    _block_align(other._block_align) {}
+
+WavReader& WavReader::operator=(WavReader &&other) noexcept {
+    if (this != &other) {
+        _close();
+
+        _map = std::exchange(other._map, nullptr);
+        _map_size = std::exchange(other._map_size, 0);
+        _data = std::exchange(other._data, {});
+        _options = other._options;
+        _block_align = other._block_align;
+    }
+
+    return *this;
+}
+
+WavReader::~WavReader() {
+    _close();
+}
+
+void WavReader::_parse(const std::string &path) {
+    if (!is_id(_map, "RIFF") || !is_id(_map + CHUNK_HEADER_SIZE, "WAVE")) {
+        throw Error("not a WAV file: " + path);
+    }
+
+    bool has_fmt = false;
+    bool has_data = false;
+    std::size_t offset = CHUNK_HEADER_SIZE + 4;
+    while (offset + CHUNK_HEADER_SIZE <= _map_size) {
+        const auto *id = _map + offset;
+        std::size_t size = read_u32(_map + offset + 4);
+        offset += CHUNK_HEADER_SIZE;
+
+        auto remaining = _map_size - offset;
+        if (is_id(id, "data")) {
+            // Writers that were interrupted before patching the header leave size as 0 or 0xFFFFFFFF.
+            if (size == 0 || size > remaining) {
+                size = remaining;
+            }
+            _data = Span<const uint8_t>(_map + offset, size);
+            has_data = true;
+        } else if (size > remaining) {
+            throw Error("truncated chunk in WAV file: " + path);
+        } else if (is_id(id, "fmt ")) {
+            _parse_fmt(Span<const uint8_t>(_map + offset, size));
+            has_fmt = true;
+        }
+
+        if (has_fmt && has_data) {
+            break;
+        }
+
+        // Chunks are word aligned.
+        offset += size + (size & 1);
+    }
+
+    if (!has_fmt || !has_data) {
+        throw Error("no fmt or data chunk in WAV file: " + path);
+    }
+
+    // Ignore trailing partial frame.
+    _data = _data.subspan(0, _data.size() / _block_align * _block_align);
+}
+
+void WavReader::_parse_fmt(Span<const uint8_t> chunk) {
+    if (chunk.size() < 16) {
+        throw Error("invalid fmt chunk in WAV file");
+    }
+
+    const auto *fmt = chunk.data();
+    auto tag = read_u16(fmt);
+    auto channels = read_u16(fmt + 2);
+    auto sample_rate = read_u32(fmt + 4);
+    auto bits = read_u16(fmt + 14);
+
+    if (tag == WAVE_FORMAT_EXTENSIBLE) {
+        // cbSize, valid bits per sample, channel mask, and then GUID of sub format,
+        // whose first 2 bytes are the format tag.
+        if (chunk.size() < 40) {
+            throw Error("invalid WAVE_FORMAT_EXTENSIBLE fmt chunk in WAV file");
+        }
+        tag = read_u16(fmt + 24);
+    }
+
+    SDL_AudioFormat format = 0;
+    if (tag == WAVE_FORMAT_PCM && bits == 8) {
+        format = AUDIO_U8;
+    } else if (tag == WAVE_FORMAT_PCM && bits == 16) {
+        format = AUDIO_S16LSB;
+    } else if (tag == WAVE_FORMAT_PCM && bits == 32) {
+        format = AUDIO_S32LSB;
+    } else if (tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32) {
+        format = AUDIO_F32LSB;
+    } else {
+        throw Error("unsupported WAV format: " + std::to_string(tag) +
+                ", bits per sample: " + std::to_string(bits));
+    }
+
+    if (channels == 0 || sample_rate == 0) {
+        throw Error("invalid channels or sample rate in WAV file");
+    }
+
+    _options.channels = channels;
+    _options.sample_per_second = sample_rate;
+    _options.format = format;
+    _block_align = static_cast<std::size_t>(channels) * (bits / 8);
+}
+
+void WavReader::_close() noexcept {
+    if (_map != nullptr) {
+        ::munmap(const_cast<uint8_t *>(_map), _map_size);
+        _map = nullptr;
+        _map_size = 0;
+    }
+
+    _data = {};
+}
+
+std::vector<float> read_wav_mono_f32(const std::string &path, int sample_rate) {
+    WavReader reader(path);
+    const auto &opts = reader.options();
+    auto data = reader.data();
+
+    std::vector<float> mono(reader.frames());
+    mono.resize(pcm::to_mono_f32(data.data(), data.size(), opts.format, opts.channels, mono.data()));
+
+    if (static_cast<int>(opts.sample_per_second) == sample_rate) {
+        return mono;
+    }
+
+    Resampler resampler(static_cast<int>(opts.sample_per_second), sample_rate);
+    std::vector<float> audio(resampler.max_output(mono.size()) + resampler.max_output(0));
+    auto num = resampler.process(mono, audio.data());
+    num += resampler.flush(audio.data() + num);
+    audio.resize(num);
+
+    return audio;
+}
+
+}
@@ -17,11 +17,15 @@
 #ifndef SEWENEW_ASSISTANT_WAV_H
 #define SEWENEW_ASSISTANT_WAV_H
 
-#include <fstream>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <SDL2/SDL.h>
 #include "sw/assistant/errors.h"
+#include "sw/assistant/pcm.h"
+#include "sw/assistant/span.h"
 
 namespace sw::assistant {
 
@@ -47,32 +51,173 @@ struct WavHeader {
     uint32_t data_chunk_size = 0;
 };
 
+static_assert(sizeof(WavHeader) == 44, "WavHeader should be packed as canonical 44 bytes header");
+
+struct WavWriterOptions {
+    // Audio is buffered, and written to file once the buffer is full.
+    std::size_t buffer_size = 64 * 1024;
+
+    // Start a new file once the current one reaches `max_file_size` bytes, or holds
+    // `max_file_duration` of audio. 0 for no limit, except for the 4GB limit of WAV.
+    // The first file is written to the given path, and the following ones are named
+    // by inserting their index before the extension, e.g. rec.wav, rec.1.wav, rec.2.wav.
+    uint64_t max_file_size = 0;
+    std::chrono::milliseconds max_file_duration{0};
+};
+
+// Streaming writer, i.e. audio is appended as it arrives, and memory use doesn't
+// grow with the length of the recording. The header is patched with the final sizes
+// on `flush` and `close`, so that the file is valid after each flush.
 class WavWriter {
 public:
-    WavWriter() = default;
-    
-    void write(const std::string &path, const WavOptions &options, const std::vector<uint8_t> &data) {
-        _header.num_channels = options.channels;
-        _header.sample_rate = options.sample_per_second;
-        _header.bytes_rate = options.sample_per_second * options.channels * ((SDL_AUDIO_MASK_BITSIZE & options.format) / 8);
-        if (options.channels == 1) {
-            _header.block_align = 2;
-        } else if (options.channels == 2) {
-            _header.block_align = 4;
-        } else {
-            throw Error("unsupported channel number");
-        }
-        _header.bits_per_sample = SDL_AUDIO_MASK_BITSIZE & options.format;
-
-        std::ofstream file(path, std::ios::binary);
-        file.write(reinterpret_cast<const char *>(&_header), sizeof(_header));
-        file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    explicit WavWriter(const WavWriterOptions &opts = {});
+
+    WavWriter(const WavWriter &) = delete;
+    WavWriter& operator=(const WavWriter &) = delete;
+
+    WavWriter(WavWriter &&) = delete;
+    WavWriter& operator=(WavWriter &&) = delete;
+
+    // Close the file if it's still open. Errors are ignored, call `close` to catch them.
+    ~WavWriter();
+
+    // Write the whole audio to `path`.
+    void write(const std::string &path, const WavOptions &options, const std::vector<uint8_t> &data);
+
+    void open(const std::string &path, const WavOptions &options);
+
+    // Append interleaved samples of the format given to `open`.
+    void append(const uint8_t *data, std::size_t size);
+
+    void append(Span<const uint8_t> data) {
+        append(data.data(), data.size());
+    }
+
+    // Write buffered audio to file, and patch the header.
+    void flush();
+
+    void close();
+
+    bool is_open() const {
+        return _fd >= 0;
+    }
+
+    // Path of the current file.
+    const std::string& path() const {
+        return _path;
     }
 
 private:
+    void _open_file();
+
+    void _close_file();
+
+    void _rotate();
+
+    void _write(const uint8_t *data, std::size_t size);
+
+    void _write_all(const uint8_t *data, std::size_t size);
+
+    void _flush_buffer();
+
+    void _patch_header();
+
+    std::string _rotated_path() const;
+
+    WavWriterOptions _opts;
+
     WavHeader _header;
+
+    std::string _base_path;
+
+    std::string _path;
+
+    // Index of the current file, i.e. number of rotations.
+    std::size_t _index = 0;
+
+    int _fd = -1;
+
+    std::vector<uint8_t> _buffer;
+
+    // Bytes of audio in the current file, including buffered ones.
+    uint64_t _data_size = 0;
+
+    // Max bytes of audio per file, multiple of block_align.
+    uint64_t _max_data_size = 0;
 };
 
+// Read-only view of a WAV file, which is mmapped, i.e. samples are not copied,
+// and only pages that are accessed are read from disk.
+// RIFF chunks other than `fmt ` and `data`, e.g. LIST and fact, are skipped.
+// Supported encodings are 8/16/32 bits PCM and 32 bits float, including WAVE_FORMAT_EXTENSIBLE.
+class WavReader {
+public:
+    explicit WavReader(const std::string &path);
+
+    WavReader(const WavReader &) = delete;
+    WavReader& operator=(const WavReader &) = delete;
+
+    WavReader(WavReader &&other) noexcept;
+    WavReader& operator=(WavReader &&other) noexcept;
+
+    ~WavReader();
+
+    // Format of samples. `format` is one of AUDIO_U8, AUDIO_S16LSB, AUDIO_S32LSB and AUDIO_F32LSB.
+    const WavOptions& options() const {
+        return _options;
+    }
+
+    // Number of frames, i.e. samples per channel.
+    std::size_t frames() const {
+        return _data.size() / _block_align;
+    }
+
+    // Interleaved samples as raw bytes.
+    Span<const uint8_t> data() const {
+        return _data;
+    }
+
+    // Interleaved samples. T should match the format, i.e. uint8_t, int16_t, int32_t or float.
+    // Throws Error if it doesn't match, or the data chunk is not aligned for T.
+    template <typename T>
+    Span<const T> samples() const;
+
+private:
+    void _parse(const std::string &path);
+
+    void _parse_fmt(Span<const uint8_t> chunk);
+
+    void _close() noexcept;
+
+    const uint8_t *_map = nullptr;
+
+    std::size_t _map_size = 0;
+
+    Span<const uint8_t> _data;
+
+    WavOptions _options;
+
+    std::size_t _block_align = 1;
+};
+
+template <typename T>
+Span<const T> WavReader::samples() const {
+    // WAV is little endian, i.e. typed samples are only available on little endian host.
+    if (_options.format != pcm::format_of<T>()) {
+        throw Error("sample type does not match format of WAV file");
+    }
+
+    if (reinterpret_cast<std::uintptr_t>(_data.data()) % alignof(T) != 0) {
+        throw Error("data chunk of WAV file is not aligned, read it with `data` instead");
+    }
+
+    return Span<const T>(reinterpret_cast<const T *>(_data.data()), _data.size() / sizeof(T));
+}
+
+// Read a WAV file as mono float32 at `sample_rate`, i.e. channels are averaged, and samples
+// are resampled if necessary.
+std::vector<float> read_wav_mono_f32(const std::string &path, int sample_rate);
+
 }
 
 #endif // end SEWENEW_ASSISTANT_WAV_H
@@ -0,0 +1,73 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/wav_source.h"
+#include <algorithm>
+#include "sw/assistant/errors.h"
+#include "sw/assistant/pcm.h"
+
+namespace sw::assistant {
+
+WavSource::WavSource(const std::string &path, const WavSourceOptions &opts) :
+    _reader(path), _opts(opts), _pacer(opts.speed, _reader.options()) {
+    const auto &wav_opts = _reader.options();
+    auto frame_size = pcm::sample_size(wav_opts.format) * wav_opts.channels;
+
+    _size = _reader.frames() * frame_size;
+
+    auto block_frames = static_cast<std::size_t>(wav_opts.sample_per_second) * _opts.block.count() / 1000;
+    if (block_frames == 0) {
+        throw Error("invalid WAV source block");
+    }
+    _block_size = block_frames * frame_size;
+}
+
+void WavSource::start() {
+    _pacer.start();
+}
+
+AudioRegions WavSource::peek() {
+    AudioRegions regions;
+    if (_size == 0) {
+        return regions;
+    }
+
+    auto size = static_cast<std::size_t>(std::min<uint64_t>(_block_size, _pacer.available()));
+
+    auto data = _reader.data();
+    auto first = std::min(size, _size - _pos);
+    regions.first = data.subspan(_pos, first);
+    if (_opts.loop && size > first) {
+        regions.second = data.subspan(0, std::min(size - first, _size));
+    }
+
+    return regions;
+}
+
+void WavSource::consume(std::size_t size) {
+    if (_size == 0) {
+        return;
+    }
+
+    _pacer.consume(size);
+
+    _pos += size;
+    if (_opts.loop) {
+        _pos %= _size;
+    }
+}
+
+}
@@ -0,0 +1,81 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_WAV_SOURCE_H
+#define SEWENEW_ASSISTANT_WAV_SOURCE_H
+
+#include <chrono>
+#include <string>
+#include "sw/assistant/audio_source.h"
+#include "sw/assistant/wav.h"
+
+namespace sw::assistant {
+
+struct WavSourceOptions {
+    // Relative to real time, e.g. 50 for 50x. If it's 0, audio is available as fast as it's consumed.
+    double speed = 1.0;
+
+    // Start over at end of file, i.e. the source never finishes.
+    bool loop = false;
+
+    // Max audio returned by each `peek`.
+    std::chrono::milliseconds block{100};
+};
+
+// Audio of a memory-mapped WAV file, i.e. `peek` returns regions of the mapping without copying.
+// NOTE: it's NOT thread-safe.
+class WavSource : public AudioSource {
+public:
+    explicit WavSource(const std::string &path, const WavSourceOptions &opts = {});
+
+    WavOptions options() const override {
+        return _reader.options();
+    }
+
+    void start() override;
+
+    void stop() override {}
+
+    AudioRegions peek() override;
+
+    void consume(std::size_t size) override;
+
+    bool live() const override {
+        return false;
+    }
+
+    bool finished() const override {
+        return !_opts.loop && _pos >= _size;
+    }
+
+private:
+    WavReader _reader;
+
+    WavSourceOptions _opts;
+
+    AudioPacer _pacer;
+
+    // Bytes of whole frames.
+    std::size_t _size = 0;
+
+    std::size_t _block_size = 0;
+
+    std::size_t _pos = 0;
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_WAV_SOURCE_H
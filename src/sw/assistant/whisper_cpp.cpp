@@ -15,54 +15,608 @@
  *************************************************************************/
 
 #include "sw/assistant/whisper_cpp.h"
+#include <cmath>
+#include <unordered_map>
+#include <zlib.h>
 #include "sw/assistant/errors.h"
+#include "sw/assistant/pcm.h"
 
 namespace sw::assistant {
 
-WhisperCpp::WhisperCpp(const whisper_params &params) {
-    _whisper_ctx = WhisperCtxUPtr(whisper_init_from_file(params.model.data()));
-    if (!_whisper_ctx) {
-        throw Error("failed to load whisper.cpp model");
+namespace {
+
+struct RunTiming {
+    std::chrono::steady_clock::time_point encode_begin;
+    bool encoding = false;
+
+    // Callback set by caller, if any.
+    whisper_encoder_begin_callback callback = nullptr;
+    void *user_data = nullptr;
+};
+
+std::chrono::microseconds elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+}
+
+// Encoder frames per second of audio.
+constexpr std::size_t AUDIO_CTX_PER_SECOND = 50;
+
+// whisper.cpp ignores audio shorter than 1 second, i.e. shorter audio is zero-padded to it.
+constexpr std::size_t MIN_DECODE_SAMPLES = WHISPER_SAMPLE_RATE;
+
+// Beam size of beam search if whisper_params::beam_size is not greater than 1.
+constexpr int DEFAULT_BEAM_SIZE = 5;
+
+// Size of text over its zlib compressed size, as OpenAI's whisper does.
+// Text of a decoder looping on the same phrase compresses well.
+double compression_ratio(const std::string &text) {
+    if (text.empty()) {
+        return 0.0;
+    }
+
+    auto bound = compressBound(text.size());
+    std::vector<Bytef> buf(bound);
+    auto size = bound;
+    if (compress(buf.data(), &size, reinterpret_cast<const Bytef *>(text.data()), text.size()) != Z_OK ||
+            size == 0) {
+        return 0.0;
+    }
+
+    return static_cast<double>(text.size()) / size;
+}
+
+// Same checks as whisper.cpp's temperature fallback, i.e. average log probability of tokens,
+// and entropy of the last 32 tokens, which is low if the decoder repeats itself.
+bool poor_quality(const std::vector<WhisperSegment> &segments, float logprob_thold, float entropy_thold) {
+    std::vector<whisper_token> tokens;
+    double logprob = 0.0;
+    for (const auto &segment : segments) {
+        tokens.insert(tokens.end(), segment.tokens.begin(), segment.tokens.end());
+        logprob += segment.logprob * segment.tokens.size();
+    }
+
+    if (tokens.empty()) {
+        return false;
+    }
+
+    if (logprob / tokens.size() < logprob_thold) {
+        return true;
+    }
+
+    constexpr std::size_t ENTROPY_TOKENS = 32;
+    if (tokens.size() <= ENTROPY_TOKENS) {
+        return false;
     }
 
+    std::unordered_map<whisper_token, int> counts;
+    for (auto iter = tokens.end() - ENTROPY_TOKENS; iter != tokens.end(); ++iter) {
+        ++counts[*iter];
+    }
+
+    auto entropy = 0.0;
+    for (const auto &[token, count] : counts) {
+        auto p = static_cast<double>(count) / ENTROPY_TOKENS;
+        entropy -= p * std::log(p);
+    }
+
+    return entropy < entropy_thold;
+}
+
+bool on_encoder_begin(whisper_context *ctx, whisper_state *state, void *user_data) {
+    auto *timing = static_cast<RunTiming *>(user_data);
+    if (!timing->encoding) {
+        timing->encoding = true;
+        timing->encode_begin = std::chrono::steady_clock::now();
+    }
+
+    if (timing->callback != nullptr) {
+        return timing->callback(ctx, state, timing->user_data);
+    }
+
+    return true;
+}
+
+}
+
+class WhisperCpp::SlotGuard {
+public:
+    explicit SlotGuard(WhisperCpp &whisper) : _whisper(whisper), _slot(whisper._acquire()) {}
+
+    SlotGuard(const SlotGuard &) = delete;
+    SlotGuard& operator=(const SlotGuard &) = delete;
+
+    ~SlotGuard() {
+        _whisper._release(_slot);
+    }
+
+    Slot& slot() {
+        return _slot;
+    }
+
+private:
+    WhisperCpp &_whisper;
+    Slot &_slot;
+};
+
+WhisperCpp::WhisperCpp(const whisper_params &params) :
+    _total_time(MetricsRegistry::instance().histogram("assistant_whisper_seconds",
+                "Time of whisper.cpp decoding per request")),
+    _mel_time(MetricsRegistry::instance().histogram("assistant_whisper_mel_seconds",
+                "Time of whisper.cpp before the first encoder run, i.e. computing mel spectrogram")),
+    _decode_time(MetricsRegistry::instance().histogram("assistant_whisper_decode_seconds",
+                "Time of whisper.cpp since the first encoder run, i.e. encoding and decoding")),
+    _wait_time(MetricsRegistry::instance().histogram("assistant_whisper_wait_seconds",
+                "Time waiting for a free whisper.cpp state")),
+    _audio_ms(MetricsRegistry::instance().counter("assistant_whisper_audio_ms_total",
+                "Milliseconds of audio decoded by whisper.cpp")),
+    _errors(MetricsRegistry::instance().counter("assistant_whisper_errors_total",
+                "Number of failed whisper.cpp requests")),
+    _adaptive_accepted(MetricsRegistry::instance().counter("assistant_whisper_adaptive_ctx_total",
+                "Number of requests decoded with adaptive audio context", {{"result", "accepted"}})),
+    _adaptive_fallbacks(MetricsRegistry::instance().counter("assistant_whisper_adaptive_ctx_total",
+                "Number of requests decoded with adaptive audio context", {{"result", "fallback"}})),
+    _beam_redecoded(MetricsRegistry::instance().counter("assistant_whisper_beam_redecoded_total",
+                "Number of low confidence segments decoded again with beam search")) {
+    auto start = std::chrono::steady_clock::now();
+
+    _whisper_ctx = _load(params);
+
+    _startup_timings.load = elapsed_us(start);
+
+    // Copied, so that `params` doesn't need to outlive it.
+    _language = params.language;
+    _prompt = params.prompt;
     _wparams = _params(params);
 
+    if (params.adaptive_beam) {
+        _sampling = WhisperSampling::ADAPTIVE;
+    } else if (params.beam_size > 1) {
+        _sampling = WhisperSampling::BEAM_SEARCH;
+    } else {
+        _sampling = WhisperSampling::GREEDY;
+    }
+
+    _beam_logprob_thold = params.beam_logprob_thold;
+    _beam_compression_thold = params.beam_compression_thold;
+
     _processors = params.n_processors;
+
+    _adaptive = params.adaptive_audio_ctx;
+    _audio_ctx_margin = static_cast<std::size_t>(std::max(params.audio_ctx_margin_ms, 0)) *
+        WHISPER_SAMPLE_RATE / 1000;
+
+    auto states_start = std::chrono::steady_clock::now();
+
+    auto num = std::max(params.n_states, 1);
+    for (auto idx = 0; idx < num; ++idx) {
+        auto slot = std::make_unique<Slot>();
+        if (params.n_states > 0) {
+            slot->state = WhisperStateUPtr(whisper_init_state(_whisper_ctx.get()));
+            if (!slot->state) {
+                throw Error("failed to init whisper state");
+            }
+        }
+        _free_slots.push_back(slot.get());
+        _slots.push_back(std::move(slot));
+    }
+
+    _startup_timings.init_states = elapsed_us(states_start);
+
+    if (params.warm_up_ms > 0) {
+        auto warm_up_start = std::chrono::steady_clock::now();
+
+        for (auto &slot : _slots) {
+            _warm_up(*slot, params.warm_up_ms);
+        }
+
+        _startup_timings.warm_up = elapsed_us(warm_up_start);
+    }
+
+    _startup_timings.total = elapsed_us(start);
 }
 
-std::string WhisperCpp::recognize(const std::vector<uint8_t> &wav, const WavOptions &opts) {
-    // TODO: what's if wav.size() % 2 != 0?
-    std::vector<float> pcmf32;
-    auto *wav_f32 = reinterpret_cast<const uint16_t*>(wav.data());
-    for (auto idx = 0U; idx < wav.size() / 2; ++idx) {
-        pcmf32.push_back(static_cast<float>(wav_f32[idx]) / 32768.0f);
+WhisperCpp::~WhisperCpp() {
+    {
+        std::lock_guard<std::mutex> lock(_request_mutex);
+        _stopping = true;
     }
+    _request_cv.notify_all();
 
-    if (whisper_full_parallel(_whisper_ctx.get(), _wparams, pcmf32.data(), pcmf32.size(), _processors) != 0) {
-        throw Error("failed to recognize");
+    for (auto &worker : _workers) {
+        worker.join();
     }
 
-    auto num = whisper_full_n_segments(_whisper_ctx.get());
+    for (auto &request : _requests) {
+        request.callback({}, std::make_exception_ptr(Error("whisper.cpp is destroyed")));
+    }
+}
+
+std::string WhisperCpp::recognize(const AudioView &audio) {
+    SlotGuard guard(*this);
+    auto &slot = guard.slot();
+
+    auto samples = _prepare(slot, audio);
+
+    auto segments = _transcribe(slot, _wparams, _sampling, samples);
+
     std::string result;
-    for (auto idx = 0; idx < num; ++idx) {
-        const auto *text = whisper_full_get_segment_text(_whisper_ctx.get(), idx);
+    for (const auto &segment : segments) {
         if (result.empty()) {
             result += "\n";
         }
-        result += text;
+        result += segment.text;
     }
 
     return result;
 }
 
+std::vector<WhisperSegment> WhisperCpp::transcribe(Span<const float> samples, const WhisperDecodeOptions &opts) {
+    auto wparams = _wparams;
+    if (!opts.language.empty()) {
+        wparams.language = opts.language.c_str();
+    }
+    if (!opts.prompt_tokens.empty()) {
+        wparams.prompt_tokens = opts.prompt_tokens.data();
+        wparams.prompt_n_tokens = static_cast<int>(opts.prompt_tokens.size());
+    } else if (!opts.prompt.empty()) {
+        wparams.initial_prompt = opts.prompt.c_str();
+    }
+    wparams.single_segment = opts.single_segment;
+    wparams.audio_ctx = opts.audio_ctx;
+
+    auto sampling = opts.sampling == WhisperSampling::DEFAULT ? _sampling : opts.sampling;
+
+    SlotGuard guard(*this);
+
+    return _transcribe(guard.slot(), wparams, sampling, samples);
+}
+
+void WhisperCpp::recognize_async(const AudioView &audio, AsrCallback callback) {
+    {
+        std::lock_guard<std::mutex> lock(_request_mutex);
+        if (_workers.empty()) {
+            // More workers than slots would just wait for slots.
+            for (std::size_t idx = 0; idx < _slots.size(); ++idx) {
+                _workers.emplace_back([this]() { _work(); });
+            }
+        }
+
+        _requests.push_back(Request{audio, std::move(callback)});
+    }
+
+    _request_cv.notify_one();
+}
+
+void WhisperCpp::_work() {
+    while (true) {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(_request_mutex);
+            _request_cv.wait(lock, [this]() { return _stopping || !_requests.empty(); });
+            if (_stopping) {
+                break;
+            }
+
+            request = std::move(_requests.front());
+            _requests.pop_front();
+        }
+
+        std::string text;
+        try {
+            text = recognize(request.audio);
+        } catch (...) {
+            request.callback({}, std::current_exception());
+            continue;
+        }
+
+        request.callback(std::move(text), nullptr);
+    }
+}
+
+WhisperCpp::Slot& WhisperCpp::_acquire() {
+    ScopedTimer timer(_wait_time);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [this]() { return !_free_slots.empty(); });
+
+    auto *slot = _free_slots.back();
+    _free_slots.pop_back();
+
+    return *slot;
+}
+
+void WhisperCpp::_release(Slot &slot) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _free_slots.push_back(&slot);
+    }
+
+    _cv.notify_one();
+}
+
+Span<const float> WhisperCpp::_prepare(Slot &slot, const AudioView &audio) {
+    const auto &opts = audio.options();
+    if (opts.channels == 0) {
+        throw Error("invalid channel number");
+    }
+
+    if (opts.format == AUDIO_F32SYS && opts.channels == 1 && opts.sample_per_second == WHISPER_SAMPLE_RATE &&
+            reinterpret_cast<std::uintptr_t>(audio.data()) % alignof(float) == 0) {
+        // Already in whisper's format, no copy.
+        return Span<const float>(static_cast<const float *>(audio.data()), audio.frames());
+    }
+
+    // Trailing partial frame, if any, is ignored.
+    auto &pcmf32 = slot.pcmf32;
+    pcmf32.resize(audio.frames());
+    auto frames = pcm::to_mono_f32(audio.data(), audio.bytes(), opts.format, opts.channels, pcmf32.data());
+    pcmf32.resize(frames);
+
+    if (opts.sample_per_second == WHISPER_SAMPLE_RATE) {
+        return pcmf32;
+    }
+
+    auto &resampler = slot.resampler;
+    if (!resampler || resampler->in_rate() != static_cast<int>(opts.sample_per_second)) {
+        resampler = std::make_unique<Resampler>(opts.sample_per_second, WHISPER_SAMPLE_RATE);
+    }
+
+    auto &resampled = slot.resampled;
+    resampled.resize(resampler->max_output(pcmf32.size()) + resampler->max_output(0));
+    auto num = resampler->process(pcmf32, resampled.data());
+    num += resampler->flush(resampled.data() + num);
+    resampled.resize(num);
+
+    return resampled;
+}
+
+std::vector<WhisperSegment> WhisperCpp::_transcribe(Slot &slot, whisper_full_params wparams,
+        WhisperSampling sampling, Span<const float> samples) {
+    auto start = std::chrono::steady_clock::now();
+    slot.encoding = false;
+
+    wparams.strategy = sampling == WhisperSampling::BEAM_SEARCH ?
+        WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY;
+
+    auto segments = _decode(slot, wparams, samples);
+    if (sampling != WhisperSampling::ADAPTIVE) {
+        _observe(slot, start, samples.size());
+        return segments;
+    }
+
+    auto beam = wparams;
+    beam.strategy = WHISPER_SAMPLING_BEAM_SEARCH;
+    beam.single_segment = true;
+
+    for (auto &segment : segments) {
+        if (!_low_confidence(segment)) {
+            continue;
+        }
+
+        auto audio = samples;
+        if (segments.size() > 1) {
+            // Timestamps are in milliseconds, and might be a bit off the audio.
+            auto begin = std::min<std::size_t>(std::max<int64_t>(segment.start_ms, 0) * WHISPER_SAMPLE_RATE / 1000,
+                    samples.size());
+            auto end = std::min<std::size_t>(std::max<int64_t>(segment.end_ms, 0) * WHISPER_SAMPLE_RATE / 1000,
+                    samples.size());
+            if (begin >= end) {
+                continue;
+            }
+            audio = samples.subspan(begin, end - begin);
+        }
+
+        if (audio.size() < MIN_DECODE_SAMPLES) {
+            slot.padded.assign(audio.begin(), audio.end());
+            slot.padded.resize(MIN_DECODE_SAMPLES, 0.0f);
+            audio = slot.padded;
+        }
+
+        WhisperSegment redecoded;
+        auto logprob = 0.0;
+        for (auto &part : _decode(slot, beam, audio)) {
+            redecoded.text += part.text;
+            redecoded.tokens.insert(redecoded.tokens.end(), part.tokens.begin(), part.tokens.end());
+            logprob += part.logprob * part.tokens.size();
+        }
+
+        if (redecoded.tokens.empty()) {
+            continue;
+        }
+        _beam_redecoded.add();
+        redecoded.logprob = static_cast<float>(logprob / redecoded.tokens.size());
+
+        // Keep the more confident one, and timestamps of the whole audio.
+        if (segment.tokens.empty() || redecoded.logprob >= segment.logprob) {
+            segment.text = std::move(redecoded.text);
+            segment.tokens = std::move(redecoded.tokens);
+            segment.logprob = redecoded.logprob;
+        }
+    }
+
+    // Re-decoded segments are part of the request, i.e. their audio is not counted again.
+    _observe(slot, start, samples.size());
+
+    return segments;
+}
+
+bool WhisperCpp::_low_confidence(const WhisperSegment &segment) const {
+    if (segment.tokens.empty()) {
+        return false;
+    }
+
+    return segment.logprob < _beam_logprob_thold ||
+        compression_ratio(segment.text) > _beam_compression_thold;
+}
+
+std::vector<WhisperSegment> WhisperCpp::_decode(Slot &slot,
+        const whisper_full_params &wparams, Span<const float> samples) {
+    std::vector<WhisperSegment> segments;
+    auto decoded = false;
+    if (_adaptive && wparams.audio_ctx == 0) {
+        auto audio_ctx = _adaptive_audio_ctx(samples.size());
+        if (audio_ctx > 0) {
+            auto params = wparams;
+            params.audio_ctx = audio_ctx;
+            segments = _run(slot, params, samples);
+            if (!poor_quality(segments, wparams.logprob_thold, wparams.entropy_thold)) {
+                _adaptive_accepted.add();
+                decoded = true;
+            } else {
+                _adaptive_fallbacks.add();
+            }
+        }
+    }
+
+    if (!decoded) {
+        segments = _run(slot, wparams, samples);
+    }
+
+    return segments;
+}
+
+void WhisperCpp::_observe(const Slot &slot, std::chrono::steady_clock::time_point start, std::size_t samples) {
+    auto end = std::chrono::steady_clock::now();
+
+    _total_time.observe(end - start);
+    if (slot.encoding) {
+        _mel_time.observe(slot.encode_begin - start);
+        _decode_time.observe(end - slot.encode_begin);
+    }
+    _audio_ms.add(samples * 1000 / WHISPER_SAMPLE_RATE);
+}
+
+int WhisperCpp::_adaptive_audio_ctx(std::size_t samples) const {
+    auto total = samples + _audio_ctx_margin;
+    // Round up, so that the tail of audio is always covered.
+    auto audio_ctx = (total * AUDIO_CTX_PER_SECOND + WHISPER_SAMPLE_RATE - 1) / WHISPER_SAMPLE_RATE;
+    auto full = static_cast<std::size_t>(whisper_n_audio_ctx(_whisper_ctx.get()));
+    if (audio_ctx >= full) {
+        return 0;
+    }
+
+    return static_cast<int>(audio_ctx);
+}
+
+std::vector<WhisperSegment> WhisperCpp::_run(Slot &slot,
+        const whisper_full_params &wparams, Span<const float> samples) {
+    auto *ctx = _whisper_ctx.get();
+    auto *state = slot.state.get();
+
+    RunTiming timing;
+    timing.callback = wparams.encoder_begin_callback;
+    timing.user_data = wparams.encoder_begin_callback_user_data;
+
+    auto params = wparams;
+    params.encoder_begin_callback = on_encoder_begin;
+    params.encoder_begin_callback_user_data = &timing;
+
+    auto ret = 0;
+    if (state != nullptr) {
+        ret = whisper_full_with_state(ctx, state, params, samples.data(), samples.size());
+    } else {
+        ret = whisper_full_parallel(ctx, params, samples.data(), samples.size(), _processors);
+    }
+
+    if (ret != 0) {
+        _errors.add();
+        throw Error("failed to recognize");
+    }
+
+    if (timing.encoding && !slot.encoding) {
+        slot.encoding = true;
+        slot.encode_begin = timing.encode_begin;
+    }
+
+    auto num = state != nullptr ? whisper_full_n_segments_from_state(state) : whisper_full_n_segments(ctx);
+
+    auto eot = whisper_token_eot(ctx);
+
+    std::vector<WhisperSegment> segments(num);
+    for (auto idx = 0; idx < num; ++idx) {
+        auto &segment = segments[idx];
+        int tokens = 0;
+        if (state != nullptr) {
+            segment.text = whisper_full_get_segment_text_from_state(state, idx);
+            // Timestamps are in units of 10 ms.
+            segment.start_ms = whisper_full_get_segment_t0_from_state(state, idx) * 10;
+            segment.end_ms = whisper_full_get_segment_t1_from_state(state, idx) * 10;
+            tokens = whisper_full_n_tokens_from_state(state, idx);
+        } else {
+            segment.text = whisper_full_get_segment_text(ctx, idx);
+            segment.start_ms = whisper_full_get_segment_t0(ctx, idx) * 10;
+            segment.end_ms = whisper_full_get_segment_t1(ctx, idx) * 10;
+            tokens = whisper_full_n_tokens(ctx, idx);
+        }
+
+        segment.tokens.reserve(tokens);
+        auto logprob = 0.0;
+        for (auto tok = 0; tok < tokens; ++tok) {
+            auto data = state != nullptr ?
+                whisper_full_get_token_data_from_state(state, idx, tok) :
+                whisper_full_get_token_data(ctx, idx, tok);
+            if (data.id < eot) {
+                segment.tokens.push_back(data.id);
+                logprob += data.plog;
+            }
+        }
+
+        if (!segment.tokens.empty()) {
+            segment.logprob = static_cast<float>(logprob / segment.tokens.size());
+        }
+    }
+
+    return segments;
+}
+
+WhisperCpp::WhisperCtxUPtr WhisperCpp::_load(const whisper_params &params) const {
+    WhisperCtxUPtr ctx;
+    if (params.n_states > 0) {
+        // Load weights only, and each state holds its own KV cache and buffers.
+        ctx = WhisperCtxUPtr(whisper_init_from_file_no_state(params.model.data()));
+    } else {
+        ctx = WhisperCtxUPtr(whisper_init_from_file(params.model.data()));
+    }
+
+    if (!ctx) {
+        throw Error("failed to load whisper.cpp model");
+    }
+
+    return ctx;
+}
+
+void WhisperCpp::_warm_up(Slot &slot, int32_t duration_ms) {
+    // Metrics are not updated, since it's not a request.
+    // whisper.cpp ignores audio shorter than 1 second, i.e. it wouldn't decode anything.
+    std::vector<float> silence(std::max<std::size_t>(
+                static_cast<std::size_t>(duration_ms) * WHISPER_SAMPLE_RATE / 1000, MIN_DECODE_SAMPLES));
+
+    auto wparams = _wparams;
+    wparams.single_segment = true;
+    wparams.no_context = true;
+
+    auto *ctx = _whisper_ctx.get();
+    auto ret = 0;
+    if (slot.state) {
+        ret = whisper_full_with_state(ctx, slot.state.get(), wparams, silence.data(), silence.size());
+    } else {
+        ret = whisper_full(ctx, wparams, silence.data(), silence.size());
+    }
+
+    if (ret != 0) {
+        throw Error("failed to warm up whisper.cpp");
+    }
+}
+
 whisper_full_params WhisperCpp::_params(const whisper_params &params) const {
-    auto wparams = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH);
+    // Strategy is set per request.
+    auto wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
     wparams.print_realtime = false;
     wparams.print_progress   = params.print_progress;
     wparams.print_timestamps = !params.no_timestamps;
     wparams.print_special    = params.print_special;
     wparams.translate        = params.translate;
-    wparams.language         = params.language.c_str();
+    wparams.language         = _language.c_str();
     wparams.detect_language  = params.detect_language;
     wparams.n_threads        = params.n_threads;
     wparams.n_max_text_ctx   = params.max_context >= 0 ? params.max_context : wparams.n_max_text_ctx;
@@ -79,10 +633,10 @@ whisper_full_params WhisperCpp::_params(const whisper_params &params) const {
 
     wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
 
-    wparams.initial_prompt   = params.prompt.c_str();
+    wparams.initial_prompt   = _prompt.empty() ? nullptr : _prompt.c_str();
 
     wparams.greedy.best_of        = params.best_of;
-    wparams.beam_search.beam_size = params.beam_size;
+    wparams.beam_search.beam_size = params.beam_size > 1 ? params.beam_size : DEFAULT_BEAM_SIZE;
 
     wparams.temperature_inc  = params.no_fallback ? 0.0f : wparams.temperature_inc;
     wparams.entropy_thold    = params.entropy_thold;
@@ -18,11 +18,19 @@
 #define SEWENEW_ASSISTANT_WHISPER_CPP_H
 
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <thread>
 #include <whisper.h>
+#include "sw/assistant/asr.h"
+#include "sw/assistant/metrics.h"
+#include "sw/assistant/resampler.h"
+#include "sw/assistant/span.h"
 #include "sw/assistant/wav.h"
 
 namespace sw::assistant {
@@ -37,11 +45,25 @@ struct whisper_params {
     int32_t max_context  = -1;
     int32_t max_len      =  0;
     int32_t best_of      =  2;
+    // Beam search if it's greater than 1, and greedy otherwise.
     int32_t beam_size    = -1;
+    // Number of whisper states sharing one copy of model weights, i.e. max concurrent requests.
+    // If it's 0, requests are decoded one at a time with the context's own state.
+    int32_t n_states     =  0;
+    // Milliseconds of silence decoded by each state at construction, so that the first request
+    // doesn't pay for cold caches and first-touch page faults. 0 to disable, and values under
+    // 1000 are rounded up to 1000, since whisper.cpp ignores audio shorter than 1 second.
+    int32_t warm_up_ms   =  0;
+    // Milliseconds of encoder context beyond the end of audio, if adaptive_audio_ctx is on.
+    int32_t audio_ctx_margin_ms = 1000;
 
     float word_thold    =  0.01f;
     float entropy_thold =  2.40f;
     float logprob_thold = -1.00f;
+    // Segments of adaptive_beam whose average token logprob is below `beam_logprob_thold`,
+    // or whose text's zlib compression ratio is above `beam_compression_thold`.
+    float beam_logprob_thold    = -0.50f;
+    float beam_compression_thold =  2.40f;
 
     bool speed_up        = false;
     bool debug_mode      = false;
@@ -63,6 +85,13 @@ struct whisper_params {
     bool print_progress  = false;
     bool no_timestamps   = false;
     bool log_score       = false;
+    // Run the encoder over the length of audio plus audio_ctx_margin_ms, instead of whisper's full
+    // 30 seconds context. Results failing entropy_thold or logprob_thold are decoded again with
+    // full context.
+    bool adaptive_audio_ctx = false;
+    // Decode greedily, and decode low confidence segments again with beam search of beam_size,
+    // or 5 beams if it's not greater than 1.
+    bool adaptive_beam   = false;
 
     std::string language  = "en";
     std::string prompt;
@@ -78,11 +107,94 @@ struct whisper_params {
     std::vector<std::string> fname_out = {};
 };
 
-class WhisperCpp {
+struct WhisperSegment {
+    std::string text;
+
+    // In milliseconds, relative to the start of audio.
+    int64_t start_ms = 0;
+    int64_t end_ms = 0;
+
+    // Text tokens, i.e. special tokens are excluded.
+    std::vector<whisper_token> tokens;
+
+    // Average log probability of text tokens.
+    float logprob = 0.0f;
+};
+
+// Time of each phase of WhisperCpp's construction.
+struct WhisperStartupTimings {
+    // Reading the model and building weights.
+    std::chrono::microseconds load{0};
+
+    // Allocating states, i.e. KV caches and compute buffers.
+    std::chrono::microseconds init_states{0};
+
+    std::chrono::microseconds warm_up{0};
+
+    std::chrono::microseconds total{0};
+};
+
+enum class WhisperSampling {
+    // Set by whisper_params::beam_size and whisper_params::adaptive_beam.
+    DEFAULT = 0,
+    GREEDY,
+    BEAM_SEARCH,
+    // Greedy, and low confidence segments are decoded again with beam search.
+    ADAPTIVE
+};
+
+// Per-call overrides of whisper_params. Strings are only referred to during the call.
+struct WhisperDecodeOptions {
+    // If it's empty, whisper_params::language is used.
+    std::string language;
+
+    // Tokens of previous text used as prompt. If it's empty, `prompt` is used.
+    Span<const whisper_token> prompt_tokens;
+
+    // If both it and `prompt_tokens` are empty, whisper_params::prompt is used.
+    std::string prompt;
+
+    WhisperSampling sampling = WhisperSampling::DEFAULT;
+
+    // Output a single segment, e.g. for short audio in streaming.
+    bool single_segment = false;
+
+    // Number of encoder frames (50 per second of audio). 0 for the model's full 30 seconds context,
+    // or the adaptive one if whisper_params::adaptive_audio_ctx is on.
+    int audio_ctx = 0;
+};
+
+// It's thread-safe. Concurrent requests are decoded in parallel if whisper_params::n_states > 0,
+// and serialized otherwise. whisper_params is copied, i.e. it doesn't need to outlive WhisperCpp.
+// `recognize_async` queues the request to worker threads, one per state, which are started on
+// first use, i.e. audio should be valid until callback is called.
+class WhisperCpp : public Asr {
 public:
     explicit WhisperCpp(const whisper_params &params);
 
-    std::string recognize(const std::vector<uint8_t> &wav, const WavOptions &opts);
+    WhisperCpp(const WhisperCpp &) = delete;
+    WhisperCpp& operator=(const WhisperCpp &) = delete;
+
+    WhisperCpp(WhisperCpp &&) = delete;
+    WhisperCpp& operator=(WhisperCpp &&) = delete;
+
+    // Queued requests that haven't been started fail.
+    ~WhisperCpp() override;
+
+    using Asr::recognize;
+    using Asr::recognize_async;
+
+    // Mono float32 audio at WHISPER_SAMPLE_RATE is decoded in place, and others are converted first.
+    std::string recognize(const AudioView &audio) override;
+
+    void recognize_async(const AudioView &audio, AsrCallback callback) override;
+
+    // Transcribe mono float32 audio sampled at WHISPER_SAMPLE_RATE.
+    std::vector<WhisperSegment> transcribe(Span<const float> samples, const WhisperDecodeOptions &opts = {});
+
+    const WhisperStartupTimings& startup_timings() const {
+        return _startup_timings;
+    }
 
 private:
     struct WhisperCtxDeleter {
@@ -95,13 +207,139 @@ private:
 
     using WhisperCtxUPtr = std::unique_ptr<whisper_context, WhisperCtxDeleter>;
 
+    struct WhisperStateDeleter {
+        void operator()(whisper_state *state) const {
+            if (state != nullptr) {
+                whisper_free_state(state);
+            }
+        }
+    };
+
+    using WhisperStateUPtr = std::unique_ptr<whisper_state, WhisperStateDeleter>;
+
+    // Decoding state of one request, and buffers reused across requests.
+    struct Slot {
+        // nullptr if decoding with the context's own state.
+        WhisperStateUPtr state;
+
+        // Mono float32 samples of the current request.
+        std::vector<float> pcmf32;
+
+        std::unique_ptr<Resampler> resampler;
+
+        std::vector<float> resampled;
+
+        // Short segments of adaptive sampling, zero-padded to the min length whisper.cpp decodes.
+        std::vector<float> padded;
+
+        // First encoder run of the current request, which might run whisper_full more than once.
+        std::chrono::steady_clock::time_point encode_begin;
+        bool encoding = false;
+    };
+
+    class SlotGuard;
+
+    struct Request {
+        AudioView audio;
+        AsrCallback callback;
+    };
+
+    // Refers to `_language` and `_prompt`.
     whisper_full_params _params(const whisper_params &params) const;
 
+    WhisperCtxUPtr _load(const whisper_params &params) const;
+
+    void _warm_up(Slot &slot, int32_t duration_ms);
+
+    Slot& _acquire();
+
+    void _release(Slot &slot);
+
+    // Loop of worker threads serving `recognize_async`.
+    void _work();
+
+    // Convert audio to mono float32 at WHISPER_SAMPLE_RATE, in slot's buffers if necessary.
+    Span<const float> _prepare(Slot &slot, const AudioView &audio);
+
+    std::vector<WhisperSegment> _transcribe(Slot &slot, whisper_full_params wparams,
+            WhisperSampling sampling, Span<const float> samples);
+
+    bool _low_confidence(const WhisperSegment &segment) const;
+
+    // Decode with adaptive audio context if it's enabled and wparams doesn't set one,
+    // and fall back to full context if the result looks poor.
+    std::vector<WhisperSegment> _decode(Slot &slot, const whisper_full_params &wparams, Span<const float> samples);
+
+    // Only failures are counted, and other metrics are updated per request by `_observe` in `_transcribe`.
+    std::vector<WhisperSegment> _run(Slot &slot, const whisper_full_params &wparams, Span<const float> samples);
+
+    void _observe(const Slot &slot, std::chrono::steady_clock::time_point start, std::size_t samples);
+
+    // Encoder frames covering `samples` plus margin, or 0 if it's not less than full context.
+    int _adaptive_audio_ctx(std::size_t samples) const;
+
     WhisperCtxUPtr _whisper_ctx;
 
+    std::string _language;
+
+    std::string _prompt;
+
     whisper_full_params _wparams;
 
+    // Never DEFAULT.
+    WhisperSampling _sampling = WhisperSampling::GREEDY;
+
+    float _beam_logprob_thold = 0.0f;
+
+    float _beam_compression_thold = 0.0f;
+
     int _processors = 1;
+
+    bool _adaptive = false;
+
+    // In samples.
+    std::size_t _audio_ctx_margin = 0;
+
+    std::vector<std::unique_ptr<Slot>> _slots;
+
+    std::vector<Slot *> _free_slots;
+
+    std::mutex _mutex;
+
+    std::condition_variable _cv;
+
+    // Requests of `recognize_async`, guarded by `_request_mutex`.
+    std::deque<Request> _requests;
+
+    std::vector<std::thread> _workers;
+
+    bool _stopping = false;
+
+    std::mutex _request_mutex;
+
+    std::condition_variable _request_cv;
+
+    // Total time of decoding per request, including runs falling back to full context and beam
+    // search re-decoding of low confidence segments, which is split at the first encoder run into
+    // time of computing mel spectrogram, and time of encoding and decoding.
+    Histogram &_total_time;
+    Histogram &_mel_time;
+    Histogram &_decode_time;
+
+    // Time waiting for a free state.
+    Histogram &_wait_time;
+
+    Counter &_audio_ms;
+    Counter &_errors;
+
+    // Requests decoded with adaptive audio context, whose results are accepted or decoded again.
+    Counter &_adaptive_accepted;
+    Counter &_adaptive_fallbacks;
+
+    // Segments of adaptive sampling decoded again with beam search, which output any token.
+    Counter &_beam_redecoded;
+
+    WhisperStartupTimings _startup_timings;
 };
 
 }
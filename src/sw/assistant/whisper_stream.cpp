@@ -0,0 +1,125 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/whisper_stream.h"
+#include <algorithm>
+#include "sw/assistant/errors.h"
+
+namespace sw::assistant {
+
+namespace {
+
+// whisper.cpp ignores audio shorter than 1 second, i.e. it's zero-padded to this length.
+constexpr std::size_t MIN_DECODE_SAMPLES = WHISPER_SAMPLE_RATE;
+
+std::size_t to_samples(const std::chrono::milliseconds &duration) {
+    return static_cast<std::size_t>(duration.count()) * WHISPER_SAMPLE_RATE / 1000;
+}
+
+}
+
+WhisperStream::WhisperStream(WhisperCpp &whisper, TextCallback callback, const WhisperStreamOptions &opts) :
+    _whisper(whisper),
+    _callback(std::move(callback)),
+    _opts(opts),
+    _step_samples(to_samples(opts.step)),
+    _length_samples(to_samples(opts.length)),
+    _keep_samples(to_samples(opts.keep)) {
+    if (!_callback) {
+        throw Error("WhisperStream requires a text callback");
+    }
+
+    if (_step_samples == 0 || _length_samples < _step_samples || _keep_samples >= _length_samples) {
+        throw Error("invalid whisper stream options, it requires 0 < step <= length and keep < length");
+    }
+
+    _window.reserve(_length_samples + _step_samples);
+    _padded.reserve(MIN_DECODE_SAMPLES);
+}
+
+void WhisperStream::feed(Span<const float> audio) {
+    while (!audio.empty()) {
+        // Never buffer more than a step, so that the window is bounded by length + step.
+        auto num = std::min(audio.size(), _step_samples - _new_samples);
+        _window.insert(_window.end(), audio.begin(), audio.begin() + num);
+        _new_samples += num;
+        audio = audio.subspan(num);
+
+        if (_new_samples == _step_samples) {
+            _decode(_window.size() >= _length_samples);
+        }
+    }
+}
+
+void WhisperStream::flush() {
+    // Skip windows with only audio that has been committed in the previous window.
+    if (_window.size() > _keep_samples || _new_samples > 0) {
+        _decode(true);
+    }
+
+    reset();
+}
+
+void WhisperStream::reset() {
+    _window.clear();
+    _new_samples = 0;
+    _prompt.clear();
+}
+
+void WhisperStream::_decode(bool commit) {
+    _new_samples = 0;
+
+    WhisperDecodeOptions opts;
+    opts.prompt_tokens = _prompt;
+    opts.single_segment = true;
+    opts.audio_ctx = _opts.audio_ctx;
+
+    Span<const float> audio = _window;
+    if (_window.size() < MIN_DECODE_SAMPLES) {
+        _padded.assign(_window.begin(), _window.end());
+        _padded.resize(MIN_DECODE_SAMPLES, 0.0f);
+        audio = _padded;
+    }
+
+    auto segments = _whisper.transcribe(audio, opts);
+
+    StreamingText text;
+    text.committed = commit;
+    for (const auto &segment : segments) {
+        text.text += segment.text;
+    }
+
+    if (commit) {
+        for (const auto &segment : segments) {
+            _prompt.insert(_prompt.end(), segment.tokens.begin(), segment.tokens.end());
+        }
+
+        if (_prompt.size() > _opts.max_prompt_tokens) {
+            _prompt.erase(_prompt.begin(), _prompt.end() - _opts.max_prompt_tokens);
+        }
+
+        // Start the next window with the tail of this one.
+        auto keep = std::min(_keep_samples, _window.size());
+        _window.erase(_window.begin(), _window.end() - keep);
+    } else if (text.text.empty()) {
+        // Nothing to replace the previous partial with.
+        return;
+    }
+
+    _callback(text);
+}
+
+}
@@ -0,0 +1,102 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_WHISPER_STREAM_H
+#define SEWENEW_ASSISTANT_WHISPER_STREAM_H
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include "sw/assistant/span.h"
+#include "sw/assistant/whisper_cpp.h"
+
+namespace sw::assistant {
+
+struct WhisperStreamOptions {
+    // Audio is re-decoded whenever `step` of new audio arrives.
+    std::chrono::milliseconds step{300};
+
+    // Max length of the sliding window. Once the window is full, its text is committed,
+    // and the window restarts with the last `keep` of audio.
+    std::chrono::milliseconds length{5000};
+
+    // Audio carried into the next window, so that words on the boundary are not cut.
+    std::chrono::milliseconds keep{200};
+
+    // Max committed tokens carried forward as prompt of the next window.
+    std::size_t max_prompt_tokens = 224;
+
+    // Encoder context, see WhisperDecodeOptions::audio_ctx. Smaller context, faster decoding.
+    int audio_ctx = 0;
+};
+
+struct StreamingText {
+    std::string text;
+
+    // If it's false, text is a partial hypothesis of the current window, which will be
+    // replaced by the next one. Otherwise, text of the window is final.
+    // Empty partials are not reported.
+    bool committed = false;
+};
+
+// Incremental transcription of a 16 kHz mono float32 audio stream.
+// NOTE: it's NOT thread-safe, while a WhisperCpp instance can be shared by many streams.
+class WhisperStream {
+public:
+    using TextCallback = std::function<void (const StreamingText &)>;
+
+    WhisperStream(WhisperCpp &whisper, TextCallback callback, const WhisperStreamOptions &opts = {});
+
+    // Decoding runs on the caller's thread, whenever a step of new audio is buffered.
+    void feed(Span<const float> audio);
+
+    // End of stream. Decode what's left of the window, and commit its text.
+    void flush();
+
+    void reset();
+
+private:
+    void _decode(bool commit);
+
+    WhisperCpp &_whisper;
+
+    TextCallback _callback;
+
+    WhisperStreamOptions _opts;
+
+    std::size_t _step_samples = 0;
+
+    std::size_t _length_samples = 0;
+
+    std::size_t _keep_samples = 0;
+
+    // Audio of the current window.
+    std::vector<float> _window;
+
+    // Window zero-padded to the min length whisper.cpp decodes.
+    std::vector<float> _padded;
+
+    // Samples received since the last decoding.
+    std::size_t _new_samples = 0;
+
+    // Committed tokens, i.e. prompt of the next decoding.
+    std::vector<whisper_token> _prompt;
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_WHISPER_STREAM_H
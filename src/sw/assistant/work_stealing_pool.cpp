@@ -0,0 +1,155 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "sw/assistant/work_stealing_pool.h"
+#include "sw/assistant/errors.h"
+
+namespace {
+
+// Pool and index of the worker running on the current thread.
+thread_local const sw::assistant::WorkStealingPool *current_pool = nullptr;
+thread_local std::size_t current_worker = 0;
+
+}
+
+namespace sw::assistant {
+
+WorkStealingPool::WorkStealingPool(std::size_t num_workers) {
+    if (num_workers == 0) {
+        throw Error("work stealing pool requires at least 1 worker");
+    }
+
+    _workers.reserve(num_workers);
+    for (std::size_t idx = 0; idx < num_workers; ++idx) {
+        _workers.push_back(std::make_unique<Worker>());
+    }
+
+    _threads.reserve(num_workers);
+    for (std::size_t idx = 0; idx < num_workers; ++idx) {
+        _threads.emplace_back([this, idx]() { _work(idx); });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+
+    _task_cv.notify_all();
+
+    for (auto &thread : _threads) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::submit(Task task) {
+    auto idx = (current_pool == this) ? current_worker :
+        _next.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+
+    {
+        auto &worker = *_workers[idx];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_queued;
+        ++_unfinished;
+    }
+
+    _task_cv.notify_one();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done_cv.wait(lock, [this]() { return _unfinished == 0; });
+
+    if (_error) {
+        auto err = _error;
+        _error = nullptr;
+        std::rethrow_exception(err);
+    }
+}
+
+void WorkStealingPool::_work(std::size_t idx) {
+    current_pool = this;
+    current_worker = idx;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _task_cv.wait(lock, [this]() { return _queued > 0 || _stopping; });
+            if (_queued == 0) {
+                // Stopping, and all tasks have been claimed.
+                break;
+            }
+
+            // Claim a task. Tasks are pushed before they're counted, so there's always one to pop.
+            --_queued;
+        }
+
+        Task task;
+        while (!_pop(idx, task)) {
+            std::this_thread::yield();
+        }
+
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error) {
+                _error = std::current_exception();
+            }
+        }
+
+        // Release captured resources before reporting the task done.
+        task = nullptr;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_unfinished == 0) {
+            _done_cv.notify_all();
+        }
+    }
+}
+
+bool WorkStealingPool::_pop(std::size_t idx, Task &task) {
+    {
+        auto &worker = *_workers[idx];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.tasks.empty()) {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (std::size_t offset = 1; offset < _workers.size(); ++offset) {
+        auto &victim = *_workers[(idx + offset) % _workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            _steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}
@@ -0,0 +1,104 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_ASSISTANT_WORK_STEALING_POOL_H
+#define SEWENEW_ASSISTANT_WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sw::assistant {
+
+// Thread pool with a task deque per worker. A worker runs its own tasks in LIFO order,
+// and steals the oldest tasks of others when it runs out of work. Tasks submitted by a worker
+// go to its own deque, and tasks submitted by other threads are distributed round-robin.
+// Tasks are expected to be coarse, e.g. decoding a segment of audio, so deques are guarded by mutexes.
+class WorkStealingPool {
+public:
+    using Task = std::function<void ()>;
+
+    explicit WorkStealingPool(std::size_t num_workers);
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool &) = delete;
+
+    WorkStealingPool(WorkStealingPool &&) = delete;
+    WorkStealingPool& operator=(WorkStealingPool &&) = delete;
+
+    // Runs all submitted tasks before joining workers.
+    ~WorkStealingPool();
+
+    void submit(Task task);
+
+    // Block until all submitted tasks are done, and rethrow the first exception thrown by tasks.
+    // NOTE: it should NOT be called by tasks.
+    void wait();
+
+    std::size_t size() const {
+        return _workers.size();
+    }
+
+    // Number of tasks run by workers other than the one they were submitted to.
+    uint64_t steals() const {
+        return _steals.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void _work(std::size_t idx);
+
+    bool _pop(std::size_t idx, Task &task);
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+
+    std::vector<std::thread> _threads;
+
+    std::mutex _mutex;
+
+    std::condition_variable _task_cv;
+
+    std::condition_variable _done_cv;
+
+    // Tasks in deques that no worker has claimed yet.
+    std::size_t _queued = 0;
+
+    // Tasks that are queued or running.
+    std::size_t _unfinished = 0;
+
+    bool _stopping = false;
+
+    std::exception_ptr _error;
+
+    std::atomic<std::size_t> _next{0};
+
+    std::atomic<uint64_t> _steals{0};
+};
+
+}
+
+#endif // end SEWENEW_ASSISTANT_WORK_STEALING_POOL_H
@@ -0,0 +1,368 @@
+/**************************************************************************
+   Copyright (c) 2023 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+// Batch transcription of WAV files. Files are split at VAD silence boundaries into segments
+// of at most --max-segment seconds, and segments are decoded on a work stealing pool, whose
+// workers share one copy of whisper weights, each with its own whisper state.
+// Transcripts are written in the order of files and segments, and stats go to stderr.
+//
+// Usage: assistant_batch --whisper ggml-model.bin [--vad silero_vad.onnx] [--workers N] [--threads N]
+//                        [--language en] [--max-segment seconds] [--output transcripts.txt] path...
+//
+// Directories are searched recursively for *.wav files.
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sw/assistant/errors.h"
+#include "sw/assistant/vad.h"
+#include "sw/assistant/wav.h"
+#include "sw/assistant/whisper_cpp.h"
+#include "sw/assistant/work_stealing_pool.h"
+
+namespace {
+
+using namespace sw::assistant;
+
+struct Config {
+    std::string whisper_model;
+    std::string vad_model;
+    std::string language = "en";
+    std::string output;
+    std::vector<std::string> paths;
+
+    int workers = 0;
+    int threads = 0;
+    int max_segment = 30;
+};
+
+struct SegmentResult {
+    // In samples, relative to the start of file.
+    int64_t start = 0;
+    int64_t end = 0;
+
+    std::vector<WhisperSegment> segments;
+
+    std::string error;
+};
+
+struct FileResult {
+    std::string path;
+
+    double seconds = 0.0;
+
+    std::vector<SegmentResult> segments;
+
+    std::string error;
+};
+
+void usage(const char *name) {
+    std::fprintf(stderr, "Usage: %s --whisper ggml-model.bin [--vad silero_vad.onnx] [--workers N] [--threads N] "
+            "[--language en] [--max-segment seconds] [--output transcripts.txt] path...\n", name);
+}
+
+bool is_wav(const std::filesystem::path &path) {
+    auto ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+            [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext == ".wav";
+}
+
+// Sorted, so that output is stable across runs.
+std::vector<std::string> discover(const std::vector<std::string> &paths) {
+    std::vector<std::string> files;
+    for (const auto &path : paths) {
+        if (std::filesystem::is_directory(path)) {
+            for (const auto &entry : std::filesystem::recursive_directory_iterator(path)) {
+                if (entry.is_regular_file() && is_wav(entry.path())) {
+                    files.push_back(entry.path().string());
+                }
+            }
+        } else {
+            files.push_back(path);
+        }
+    }
+
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+
+    return files;
+}
+
+// Pack speech chunks into segments of at most `max_samples`, i.e. segments only break at
+// silence, unless a single chunk is longer than that, which is split into pieces of equal length,
+// so that there's no short remainder.
+std::vector<SegmentResult> split(Span<const float> audio, VadModel *vad, int64_t max_samples) {
+    std::vector<SpeechChunk> chunks;
+    if (vad != nullptr) {
+        VadOptions opts;
+        opts.sample_rate = WHISPER_SAMPLE_RATE;
+        chunks = vad->predict(audio, opts);
+    } else {
+        SpeechChunk chunk;
+        chunk.end = static_cast<int64_t>(audio.size());
+        chunks.push_back(chunk);
+    }
+
+    std::vector<SegmentResult> segments;
+    auto add = [&](int64_t start, int64_t end) {
+        auto pieces = (end - start + max_samples - 1) / max_samples;
+        auto len = (end - start + pieces - 1) / pieces;
+        for (auto pos = start; pos < end; pos += len) {
+            SegmentResult segment;
+            segment.start = pos;
+            segment.end = std::min(pos + len, end);
+            segments.push_back(std::move(segment));
+        }
+    };
+
+    int64_t start = -1;
+    int64_t end = -1;
+    for (const auto &chunk : chunks) {
+        if (start >= 0 && chunk.end - start <= max_samples) {
+            end = std::max(end, chunk.end);
+            continue;
+        }
+
+        if (start >= 0) {
+            add(start, end);
+        }
+
+        // Padded chunks might overlap.
+        start = std::max(chunk.start, end);
+        end = chunk.end;
+    }
+
+    if (start >= 0) {
+        add(start, end);
+    }
+
+    return segments;
+}
+
+std::string format_time(int64_t ms) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%02d:%02d:%02d.%03d",
+            static_cast<int>(ms / 3600000), static_cast<int>(ms / 60000 % 60),
+            static_cast<int>(ms / 1000 % 60), static_cast<int>(ms % 1000));
+    return buf;
+}
+
+void write(std::ostream &os, const std::vector<FileResult> &results) {
+    for (const auto &result : results) {
+        os << result.path << "\n";
+        if (!result.error.empty()) {
+            os << "error: " << result.error << "\n\n";
+            continue;
+        }
+
+        for (const auto &segment : result.segments) {
+            auto offset_ms = segment.start * 1000 / WHISPER_SAMPLE_RATE;
+            if (!segment.error.empty()) {
+                os << "[" << format_time(offset_ms) << "] error: " << segment.error << "\n";
+                continue;
+            }
+
+            for (const auto &s : segment.segments) {
+                os << "[" << format_time(offset_ms + s.start_ms) << " --> "
+                    << format_time(offset_ms + s.end_ms) << "]" << s.text << "\n";
+            }
+        }
+
+        os << "\n";
+    }
+}
+
+int run(const Config &config) {
+    auto files = discover(config.paths);
+    if (files.empty()) {
+        std::fprintf(stderr, "no WAV file found\n");
+        return 1;
+    }
+
+    auto cores = static_cast<int>(std::max(1U, std::thread::hardware_concurrency()));
+    auto threads = config.threads > 0 ? config.threads : 2;
+    auto workers = config.workers > 0 ? config.workers : std::max(1, cores / threads);
+
+    whisper_params params;
+    params.model = config.whisper_model;
+    params.language = config.language;
+    params.n_threads = threads;
+    params.n_processors = 1;
+    params.n_states = workers;
+
+    auto load_start = std::chrono::steady_clock::now();
+    WhisperCpp whisper(params);
+    std::unique_ptr<VadModel> vad;
+    if (!config.vad_model.empty()) {
+        vad = std::make_unique<VadModel>(config.vad_model);
+    }
+    auto load_end = std::chrono::steady_clock::now();
+
+    std::vector<FileResult> results(files.size());
+    auto max_samples = static_cast<int64_t>(config.max_segment) * WHISPER_SAMPLE_RATE;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        WorkStealingPool pool(static_cast<std::size_t>(workers));
+        for (std::size_t idx = 0; idx < files.size(); ++idx) {
+            auto &result = results[idx];
+            result.path = files[idx];
+
+            // Segment tasks are submitted by the worker which loads the file, i.e. they go to
+            // its own deque first, and idle workers steal them.
+            pool.submit([&pool, &result, &whisper, &vad, max_samples]() {
+                std::shared_ptr<const std::vector<float>> audio;
+                try {
+                    audio = std::make_shared<const std::vector<float>>(
+                            read_wav_mono_f32(result.path, WHISPER_SAMPLE_RATE));
+                    result.seconds = static_cast<double>(audio->size()) / WHISPER_SAMPLE_RATE;
+                    result.segments = split(*audio, vad.get(), max_samples);
+                } catch (const std::exception &e) {
+                    result.error = e.what();
+                    return;
+                }
+
+                // Audio is released once its last segment is decoded.
+                for (auto &segment : result.segments) {
+                    pool.submit([&segment, &whisper, audio]() {
+                        try {
+                            Span<const float> samples(audio->data() + segment.start,
+                                    static_cast<std::size_t>(segment.end - segment.start));
+                            // whisper.cpp ignores audio shorter than 1 second, e.g. a single short word.
+                            std::vector<float> padded;
+                            if (samples.size() < WHISPER_SAMPLE_RATE) {
+                                padded.assign(samples.begin(), samples.end());
+                                padded.resize(WHISPER_SAMPLE_RATE, 0.0f);
+                                samples = padded;
+                            }
+                            segment.segments = whisper.transcribe(samples);
+                        } catch (const std::exception &e) {
+                            segment.error = e.what();
+                        }
+                    });
+                }
+            });
+        }
+
+        pool.wait();
+
+        auto end = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration<double>(end - start).count();
+
+        double audio_seconds = 0.0;
+        double segment_seconds = 0.0;
+        std::size_t segments = 0;
+        std::size_t errors = 0;
+        for (const auto &result : results) {
+            audio_seconds += result.seconds;
+            segments += result.segments.size();
+            errors += result.error.empty() ? 0 : 1;
+            for (const auto &segment : result.segments) {
+                segment_seconds += static_cast<double>(segment.end - segment.start) / WHISPER_SAMPLE_RATE;
+                errors += segment.error.empty() ? 0 : 1;
+            }
+        }
+
+        std::fprintf(stderr, "files: %zu, segments: %zu, errors: %zu\n", files.size(), segments, errors);
+        std::fprintf(stderr, "workers: %d, threads per worker: %d, steals: %llu\n",
+                workers, threads, static_cast<unsigned long long>(pool.steals()));
+        std::fprintf(stderr, "load: %.3fs, transcribe: %.3fs\n",
+                std::chrono::duration<double>(load_end - load_start).count(), elapsed);
+        std::fprintf(stderr, "audio: %.1fs, decoded: %.1fs, realtime factor: %.4f, audio seconds per sec: %.2f\n",
+                audio_seconds, segment_seconds, elapsed / std::max(audio_seconds, 1e-9),
+                audio_seconds / std::max(elapsed, 1e-9));
+
+        if (errors > 0) {
+            std::fprintf(stderr, "some files or segments failed, see output for details\n");
+        }
+    }
+
+    if (config.output.empty()) {
+        write(std::cout, results);
+    } else {
+        std::ofstream file(config.output);
+        write(file, results);
+        if (!file) {
+            std::fprintf(stderr, "failed to write %s\n", config.output.data());
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+}
+
+int main(int argc, char **argv) {
+    Config config;
+    for (int idx = 1; idx < argc; ++idx) {
+        std::string arg = argv[idx];
+        if (arg.compare(0, 2, "--") != 0) {
+            config.paths.push_back(arg);
+            continue;
+        }
+
+        if (idx + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        std::string val = argv[++idx];
+        if (arg == "--whisper") {
+            config.whisper_model = val;
+        } else if (arg == "--vad") {
+            config.vad_model = val;
+        } else if (arg == "--workers") {
+            config.workers = std::atoi(val.data());
+        } else if (arg == "--threads") {
+            config.threads = std::atoi(val.data());
+        } else if (arg == "--language") {
+            config.language = val;
+        } else if (arg == "--max-segment") {
+            config.max_segment = std::atoi(val.data());
+        } else if (arg == "--output") {
+            config.output = val;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (config.whisper_model.empty() || config.paths.empty() || config.max_segment <= 0 ||
+            config.workers < 0 || config.threads < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        return run(config);
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "batch transcription failed: %s\n", e.what());
+        return 1;
+    }
+}